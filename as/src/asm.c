@@ -5,13 +5,20 @@
  * i really should have broken this up, but it will all be rewritten in assembly later...
  */
 #include "asm.h"
+#include "lex.h"
 #include "sio.h"
+#include "stat.h"
+#include "list.h"
+#include "cfg.h"
+#include "stk.h"
+#include "page.h"
 
 // instruction table
 #include "isr.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /*
  * there are a number of global variables to reduce the amount of data being passed
@@ -21,6 +28,36 @@
 char token_buf[TOKEN_BUF_SIZE];
 char sym_name[TOKEN_BUF_SIZE];
 
+/* last token read */
+struct token tok_cur;
+
+/* position in the string being read */
+int str_i;
+
+/* repeated blocks being played back, innermost last */
+struct rept rept_stack[REPT_DEPTH];
+int rept_depth;
+
+/* type of the last operand that asm_arg evaluated */
+uint8_t arg_type;
+
+/* bytes of the instruction being assembled */
+uint8_t isr_bytes[4];
+int isr_n;
+
+/* type of the external the instruction refers to, 0 if none */
+uint8_t isr_ext;
+
+/* where each segment starts on the second pass */
+uint16_t seg_base[4];
+
+/* alignment needed by each segment, as a power of 2 */
+uint8_t seg_align[4];
+
+/* padding at the ends of text and data, so the next segment starts aligned */
+uint16_t text_pad;
+uint16_t data_pad;
+
 /* current assembly address */
 uint16_t asm_address;
 
@@ -45,11 +82,24 @@ struct tval exp_vstack[EXP_STACK_DEPTH];
 /* expression stack */
 char exp_estack[EXP_STACK_DEPTH];
 
-/* head of symbol table */
+/* head of symbol table, the root level symbols are kept in pages */
 struct symbol *sym_table;
+struct ptable sym_pages;
+
+/* root symbols by name, kept in memory so a lookup only reads the page of the hit */
+int sym_head[SYM_HASH];
+int sym_tail[SYM_HASH];
+struct sindex *sym_link;
+int sym_slink;
+
+/* record number of the root symbol last found or added */
+int sym_rec;
+
+/* local table */
+struct ptable loc_pages;
 
-/* head of local table */
-struct local *loc_table;
+/* locals by label, kept in memory */
+struct lindex loc_idx[LOC_LABELS];
 
 /* counts how many locals have been encountered this pass */
 int loc_cnt;
@@ -71,8 +121,74 @@ int loc_count;
 int glob_count;
 int reloc_count;
 
+/* most Z80 memory the tables may use, 0 if there is no limit */
+long z80_budget;
+
+/* Z80 memory held by each table right now */
+long z80_use[ZU_COUNT];
+
+/* most Z80 memory used while each source was being read */
+struct zmark *z80_mark;
+
 /* extern number */
 uint8_t extn;
+
+/* first pass is being run again to relax jumps */
+char asm_rerun;
+
+/* next local to update when the first pass is run again, -1 if not */
+int loc_redo;
+
+/* relaxed jumps, set if a jump must be long, by order of appearance */
+char *jmp_long;
+int jmp_size;
+
+/* relaxed jumps seen this pass, and how many were made long or had unknown targets */
+int jmp_cnt;
+int jmp_flips;
+int jmp_unknown;
+
+/* peephole rules on constants, set if the constant is zero, by order of appearance */
+char *peep_zero;
+int peep_size;
+int peep_cnt;
+
+/* the next line was folded into the last instruction, and should be skipped */
+char peep_skip;
+
+/* how many times each peephole rule was used */
+int peep_hits[PEEP_RULES];
+
+/* peephole optimizations enabled */
+char asm_opt;
+
+/* stack report wanted, 2 for json */
+char asm_stack;
+
+/* line table wanted */
+char asm_lines;
+
+/* line table rows, in address order */
+struct lrow *line_row;
+int line_n;
+int line_size;
+
+/* precompiled header to preload, and if one should be emitted instead of an object */
+char *pch_in;
+char pch_out;
+
+/* output index of each symbol placed in a precompiled header, hashed by address */
+struct symbol **pch_key;
+int *pch_idx;
+int pch_mask;
+
+/* error recovery point */
+jmp_buf *asm_recover;
+
+/* allocation chunks */
+struct chunk *chunk_head;
+struct chunk *chunk_curr;
+
 /*
  * checks if a string is equal
  * string a is read as lower case
@@ -99,6 +215,21 @@ char asm_sequ(char *a, char *b) {
 	
 }
 
+/*
+ * gives up on the assembly, after the reason has been printed
+ */
+void asm_abort()
+{
+	lex_close();
+	sio_abort();
+	list_abort();
+	
+	// the caller may want to try again
+	if (asm_recover)
+		longjmp(*asm_recover, 1);
+	exit(1);
+}
+
 /*
  * prints out an error message and exits
  *
@@ -106,22 +237,168 @@ char asm_sequ(char *a, char *b) {
  */
 void asm_error(char *msg)
 {
-	sio_status();
+	sio_status(tok_cur.file, tok_cur.line);
 	printf(": %s\n", msg);
-	sio_close();
-	exit(1);
+	asm_abort();
+}
+
+/*
+ * works out how much memory the tables would take up on a Z80, going by how many symbols, locals, globals and reloc blocks there are
+ */
+long asm_z80_used()
+{
+	return (long) Z80_SYMBOL * sym_count + (long) Z80_LOCAL * loc_count + (long) Z80_GLOBAL * glob_count + (long) Z80_RELOC * reloc_count;
+}
+
+/*
+ * adds up the Z80 memory held by every table right now
+ */
+long asm_z80_held()
+{
+	long used;
+	int i;
+	
+	used = 0;
+	for (i = 0; i < ZU_COUNT; i++)
+		used += z80_use[i];
+	
+	return used;
+}
+
+/*
+ * prints out the most Z80 memory used while each source was read, and how it was split between the tables
+ */
+void asm_z80_report()
+{
+	struct zmark *m;
+	int i, j;
+	
+	printf("%-16s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "source", "total", "symbols", "locals", "globals", "relocs", "rept", "jumps", "peep", "lines", "index", "pages", "estimate");
+	for (i = 0; i < sio_count(); i++) {
+		m = &z80_mark[i];
+		if (!m->used)
+			continue;
+		
+		printf("%-16s %8ld", i ? sio_name(i) : "preloaded", m->used);
+		for (j = 0; j < ZU_COUNT; j++)
+			printf(" %8ld", m->part[j]);
+		printf(" %8ld\n", m->model);
+	}
+	printf("%-16s %8ld\n", "budget", z80_budget);
+}
+
+/*
+ * checks Z80 memory use against the budget after a table has grown
+ * the assembly stops as soon as the budget is gone
+ *
+ * file = argument index of the source being read
+ */
+void asm_z80_check(int file)
+{
+	struct zmark *m;
+	long used;
+	
+	if (!z80_budget || !z80_mark)
+		return;
+	
+	// the page cache is what holds root symbols and locals when it is limited
+	z80_use[ZU_PAGE] = page_bytes();
+	used = asm_z80_held();
+	m = &z80_mark[file];
+	if (used > m->used) {
+		m->used = used;
+		memcpy(m->part, z80_use, sizeof(z80_use));
+		m->model = asm_z80_used();
+	}
+	
+	if (used > z80_budget) {
+		sio_status(tok_cur.file, tok_cur.line);
+		printf(": out of Z80 memory, %ld bytes needed with a budget of %ld\n", used, z80_budget);
+		asm_z80_report();
+		asm_abort();
+	}
+}
+
+/*
+ * counts Z80 memory taken up or given back by a table, checking the budget if it grew
+ *
+ * part = table (ZU_*)
+ * bytes = bytes taken, or given back if negative
+ */
+void asm_z80_take(int part, long bytes)
+{
+	z80_use[part] += bytes;
+	if (bytes > 0)
+		asm_z80_check(tok_cur.file);
+}
+
+/*
+ * counts an entry of a table that is filled in again on every pass, only the first time it is used
+ *
+ * part = table (ZU_*)
+ * n = entry number
+ * size = Z80 size of an entry
+ */
+void asm_z80_entry(int part, int n, int size)
+{
+	if ((long) (n + 1) * size > z80_use[part])
+		asm_z80_take(part, (long) (n + 1) * size - z80_use[part]);
 }
 
 
 /*
  * allocates memory from the heap
- * since no de-allocation is needed, data could just be appended to the heap
+ * since no de-allocation is needed, data is just appended to the current chunk
+ * chunks are never freed, and get reused after asm_release()
  *
  * size = number of bytes to allocate
  */
 void *asm_alloc(int size)
 {
-	return (void *) malloc(size);
+	struct chunk *new;
+	void *out;
+	
+	// keep everything pointer aligned
+	size = (size + 7) & ~7;
+	
+	if (!chunk_curr || chunk_curr->used + size > chunk_curr->size) {
+		// try to reuse the next chunk
+		new = chunk_curr ? chunk_curr->next : chunk_head;
+		
+		if (!new || new->size < size) {
+			// nope, need a new one
+			new = (struct chunk *) malloc(sizeof(struct chunk) + (size > CHUNK_SIZE ? size : CHUNK_SIZE));
+			if (!new)
+				asm_error("out of memory");
+			new->size = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+			
+			// insert it after the current chunk
+			if (chunk_curr) {
+				new->next = chunk_curr->next;
+				chunk_curr->next = new;
+			} else {
+				new->next = chunk_head;
+				chunk_head = new;
+			}
+		}
+		
+		new->used = 0;
+		chunk_curr = new;
+	}
+	
+	out = (uint8_t *) (chunk_curr + 1) + chunk_curr->used;
+	chunk_curr->used += size;
+	stat_heap += size;
+	
+	return out;
+}
+
+/*
+ * releases everything allocated with asm_alloc()
+ */
+void asm_release()
+{
+	chunk_curr = NULL;
 }
 
 /*
@@ -136,6 +413,7 @@ struct reloc *asm_alloc_reloc()
 	
 	// allocate start of relocation table
 	reloc_count++;
+	asm_z80_take(ZU_RELOC, Z80_RELOC);
 	new = (struct reloc *) asm_alloc(sizeof(struct reloc));
 	for (i = 0; i < RELOC_SIZE; i++) new->toff[i].off = 255;
 	new->next = NULL;
@@ -156,80 +434,122 @@ void asm_token_cache(char *token_cache)
 
 
 /*
- * skips past all of the white space to a token
+ * tests if a character is a number
+ *
+ * in = character to test
+ * returns true (1) or false (0)
  */
-void asm_wskip()
+char asm_num(char in)
 {
-	char comment;
-	
-	comment = 0;
-	while ((sio_peek() <= ' ' || sio_peek() == ';' || comment) && sio_peek() != '\n' && sio_peek() != -1)
-		if (sio_next() == ';') comment = 1;
+	return (in >= '0' && in <= '9');
 }
 
 /*
- * tests if a character is a alpha (aA - zZ or underscore)
- *
- * in = character to test
- * returns true (1) or false (0)
+ * drops any repeated blocks that have been played back in full
+ * reading carries on from the end of the block, so that is where the assembler is
  */
-char asm_alpha(char in)
+void asm_rept_pop()
 {
-	return (in >= 'A' && in <= 'Z') || (in >= 'a' && in <= 'z') || in == '_';
+	struct rept *r;
+	
+	while (rept_depth) {
+		r = &rept_stack[rept_depth - 1];
+		if (r->pos < r->n)
+			return;
+		
+		// start the next time through
+		if (++r->iter < r->count) {
+			r->pos = 0;
+			return;
+		}
+		
+		rept_depth--;
+		asm_z80_take(ZU_REPT, -r->z80);
+		tok_cur.file = r->end.file;
+		tok_cur.line = r->end.line;
+	}
 }
 
 /*
- * tests if a character is a alpha
+ * returns a token further on without reading anything
+ * repeated blocks are looked through first, then the lexer
  *
- * in = character to test
- * returns true (1) or false (0)
+ * n = number of tokens to skip over
  */
-char asm_num(char in)
+struct token *asm_ahead(int n)
 {
-	return (in >= '0' && in <= '9');
+	struct rept *r;
+	int i, left;
+	
+	for (i = rept_depth - 1; i >= 0; i--) {
+		r = &rept_stack[i];
+		
+		// tokens left in this block, over every time through
+		left = r->n - r->pos + r->n * (r->count - r->iter - 1);
+		if (n < left)
+			return &r->tok[(r->pos + n) % r->n];
+		n -= left;
+	}
+	
+	return lex_ahead(n);
 }
 
 /*
- * reads the next token in from the source, buffers if needed, and returns type
- * white space will by cycled past, both in front and behind the token
+ * reads the next token in from the lexer, buffers if needed, and returns type
+ * tokens come out of the innermost repeated block, if there is one
  */
 char asm_token_read() 
 {
-	char c, out;
-	int i;
-
-	// skip all leading white space
-	asm_wskip();
+	int i, file, line;
+	char last;
+	struct rept *r;
 	
-	// peek and check type
-	out = c = sio_peek();
-	if (asm_alpha(c))
-		out = 'a';
-	else if (asm_num(c))
-		out = '0';
+	last = tok_cur.type;
+	asm_rept_pop();
+	file = tok_cur.file;
+	line = tok_cur.line;
 	
-	if (out == 'a' || out == '0') {
-			// scan in the buffer if needed
-		i = 0;
-		while (asm_num(c) || asm_alpha(c)) {
-			if (i < TOKEN_BUF_SIZE - 1)
-				token_buf[i++] = c;
-			
-			sio_next();
-			c = sio_peek();
-		}
-		token_buf[i] = 0;
-	} else {
-		sio_next();
+	if (rept_depth) {
+		r = &rept_stack[rept_depth - 1];
+		
+		// update the counter at the start of each time through
+		if (!r->pos && r->sym >= 0)
+			((struct symbol *) page_get(&sym_pages, r->sym, 1))->value = r->iter;
+		
+		tok_cur = r->tok[r->pos++];
+	} else
+		lex_get(&tok_cur);
+	
+	// a line is done, list it
+	// repeated lines are listed all together at the end of the block
+	if (asm_pass && list_active() && !rept_depth) {
+		if (tok_cur.type == 'n' || (tok_cur.type == -1 && last != 'n' && last != -1))
+			list_line(file, line);
+	}
+	
+	// scan in the buffer if needed
+	if (tok_cur.type == 'a' || tok_cur.type == '0') {
+		for (i = 0; i <= tok_cur.len; i++)
+			token_buf[i] = tok_cur.text[i];
 	}
 	
-	// correct for new lines
-	if (out == '\n') out = 'n';
+	return tok_cur.type;
+}
+
+/*
+ * returns the first character of the next token, without reading it
+ */
+char asm_peek()
+{
+	struct token *t;
 	
-	// skip more whitespace 
-	asm_wskip();
+	t = asm_ahead(0);
+	if (t->type == 'a' || t->type == '0')
+		return t->text[0];
+	if (t->type == 'n')
+		return '\n';
 	
-	return out;
+	return t->type;
 }
 
 /*
@@ -243,7 +563,7 @@ void asm_expect(char c)
 	char tok;
 	
 	if (c == '}') {
-		while (sio_peek() == '\n')
+		while (asm_peek() == '\n')
 			asm_token_read();
 	}
 	
@@ -254,7 +574,7 @@ void asm_expect(char c)
 	}
 	
 	if (c == '{' || c == ',') {
-		while (sio_peek() == '\n')
+		while (asm_peek() == '\n')
 			asm_token_read();
 	}
 }
@@ -312,15 +632,15 @@ int asm_char_parse(char in)
 }
 
 /*
- * attempts to parse a number into an unsigned 16 bit integer
+ * attempts to parse a number, without cutting it down to 16 bits
  *
  * in = pointer to string
  * returns actual value of number
  */
-uint16_t asm_num_parse(char *in)
+long asm_num_long(char *in)
 {
 	int num_start, num_end, i;
-	uint16_t out;
+	long out;
 	char radix; // 0 = ?, 2 = binary, 8 = octal, 10 = decimal, 16 = hex
 	
 	// default is base 10
@@ -360,6 +680,84 @@ uint16_t asm_num_parse(char *in)
 	return out;
 }
 
+/*
+ * attempts to parse a number into an unsigned 16 bit integer
+ *
+ * in = pointer to string
+ * returns actual value of number
+ */
+uint16_t asm_num_parse(char *in)
+{
+	return asm_num_long(in);
+}
+
+/*
+ * checks if a symbol has a name
+ *
+ * entry = symbol
+ * sym = name
+ * returns true (1) or false (0)
+ */
+char asm_sym_name(struct symbol *entry, char *sym)
+{
+	int i;
+	char equal;
+	
+	// compare strings
+	equal = 1;
+	for (i = 0; i < SYMBOL_NAME_SIZE; i++) {
+		if (entry->name[i] != sym[i]) equal = 0;
+		if (!entry->name[i]) break;
+	}
+	
+	return equal;
+}
+
+/*
+ * hashes a symbol name, 32 bit FNV-1a
+ *
+ * name = symbol name
+ */
+uint32_t asm_sym_hash(char *name)
+{
+	uint32_t h;
+	int i;
+	
+	h = 2166136261u;
+	for (i = 0; i < SYMBOL_NAME_SIZE-1 && name[i]; i++)
+		h = (h ^ (uint8_t) name[i]) * 16777619u;
+	
+	return h;
+}
+
+/*
+ * adds a root level symbol to the name index
+ * symbols with the same hash stay in the order they were added
+ *
+ * rec = record number of the symbol
+ * name = symbol name
+ */
+void asm_sym_index(int rec, char *name)
+{
+	uint32_t h;
+	
+	if (rec >= sym_slink) {
+		sym_slink = sym_slink ? sym_slink * 2 : 1024;
+		if (!(sym_link = (struct sindex *) realloc(sym_link, sizeof(struct sindex) * sym_slink)))
+			asm_error("out of memory");
+	}
+	
+	h = asm_sym_hash(name);
+	sym_link[rec].hash = h;
+	sym_link[rec].next = -1;
+	
+	if (sym_tail[h % SYM_HASH] < 0)
+		sym_head[h % SYM_HASH] = rec;
+	else
+		sym_link[sym_tail[h % SYM_HASH]].next = rec;
+	sym_tail[h % SYM_HASH] = rec;
+}
+
 /*
  * fetches the symbol
  *
@@ -370,25 +768,40 @@ uint16_t asm_num_parse(char *in)
 struct symbol *asm_sym_fetch(struct symbol *table, char *sym)
 {
 	struct symbol *entry;
+	uint32_t h;
 	int i;
-	char equal;
 	
 	if (!table)
 		return NULL;
 	
+	stat_lookups++;
+	
+	// root level symbols are found through the index, only the page of a hit is read
+	if (table == sym_table) {
+		h = asm_sym_hash(sym);
+		for (i = sym_head[h % SYM_HASH]; i >= 0; i = sym_link[i].next) {
+			stat_probes++;
+			if (sym_link[i].hash != h)
+				continue;
+			
+			entry = (struct symbol *) page_get(&sym_pages, i, 1);
+			if (asm_sym_name(entry, sym)) {
+				sym_rec = i;
+				return entry;
+			}
+		}
+		
+		return NULL;
+	}
+	
 	// search for the symbol
 	entry = table->parent;
 	
 	while (entry) {
+		stat_probes++;
 		
-		// compare strings
-		equal = 1;
-		for (i = 0; i < SYMBOL_NAME_SIZE; i++) {
-			if (entry->name[i] != sym[i]) equal = 0;
-			if (!entry->name[i]) break;
-		}
-		
-		if (equal) return entry;
+		if (asm_sym_name(entry, sym))
+			return entry;
 		
 		entry = entry->next;
 	}
@@ -448,18 +861,28 @@ struct symbol *asm_sym_update(struct symbol *table, char *sym, char type, struct
 	entry = asm_sym_fetch(table, sym);
 	
 	if (!entry) {
-		if (table->parent) {
+		sym_count++;
+		
+		if (table == sym_table) {
+			entry = (struct symbol *) page_add(&sym_pages);
+			sym_rec = sym_pages.count - 1;
+			
+			// with a page cache, the pages in memory are counted instead
+			if (!page_limited())
+				asm_z80_take(ZU_SYM, Z80_SYMBOL);
+			asm_z80_take(ZU_INDEX, Z80_SINDEX);
+		} else if (table->parent) {
+			asm_z80_take(ZU_SYM, Z80_SYMBOL);
 			entry = table->parent;
 			
 			// get the last entry in the table;
 			while (entry->next)
 				entry = entry->next;
 			
-			sym_count++;
 			entry->next = (struct symbol *) asm_alloc(sizeof(struct symbol));
 			entry = entry->next;
 		} else {
-			sym_count++;
+			asm_z80_take(ZU_SYM, Z80_SYMBOL);
 			table->parent = (struct symbol *) asm_alloc(sizeof(struct symbol));
 			entry = table->parent;
 		}
@@ -471,8 +894,13 @@ struct symbol *asm_sym_update(struct symbol *table, char *sym, char type, struct
 		// copy name
 		for (i = 0; i < SYMBOL_NAME_SIZE-1 && sym[i] != 0; i++)
 			entry->name[i] = sym[i];
-		entry->name[i] = 0;
-			
+		
+		// the whole name gets emitted, so pad it out
+		while (i < SYMBOL_NAME_SIZE)
+			entry->name[i++] = 0;
+		
+		if (table == sym_table)
+			asm_sym_index(sym_rec, entry->name);
 	}
 	
 	// update the symbol
@@ -485,19 +913,209 @@ struct symbol *asm_sym_update(struct symbol *table, char *sym, char type, struct
 	return entry;
 }
 
+/*
+ * finds where a symbol goes in the precompiled header index
+ *
+ * sym = symbol
+ * returns slot holding the symbol, or the empty slot it would go in
+ */
+int asm_pch_slot(struct symbol *sym)
+{
+	int i;
+	
+	i = (int) (((uintptr_t) sym >> 3) * 2654435761u) & pch_mask;
+	while (pch_key[i] && pch_key[i] != sym)
+		i = (i + 1) & pch_mask;
+	
+	return i;
+}
+
+/*
+ * finds a symbol in a precompiled header table
+ *
+ * sym = symbol to find
+ * returns index of symbol, or -1 if not found
+ */
+int asm_pch_find(struct symbol *sym)
+{
+	int i;
+	
+	i = asm_pch_slot(sym);
+	return pch_key[i] ? pch_idx[i] : -1;
+}
+
+/*
+ * places a symbol in a precompiled header table, and records its index
+ *
+ * tab = table of symbols
+ * cnt = pointer to number of symbols in table
+ * sym = symbol to place
+ */
+void asm_pch_place(struct symbol **tab, int *cnt, struct symbol *sym)
+{
+	int i;
+	
+	i = asm_pch_slot(sym);
+	pch_key[i] = sym;
+	pch_idx[i] = *cnt;
+	tab[(*cnt)++] = sym;
+}
+
+/*
+ * writes out the absolute symbols and types as a precompiled header
+ * pointers are written as indicies + 1, so they can be fixed up on load
+ */
+void asm_pch_write()
+{
+	struct symbol **tab, *sym, *roots, rec;
+	int cnt, top, i, j, left;
+	uint8_t *b;
+	
+	// every symbol allocated so far is an upper bound, the index is kept at most half full
+	tab = (struct symbol **) malloc(sizeof(struct symbol *) * (sym_count + 2));
+	roots = (struct symbol *) malloc(sizeof(struct symbol) * (sym_pages.count + 1));
+	for (pch_mask = 255; pch_mask < 2 * (sym_count + 2); pch_mask = pch_mask * 2 + 1);
+	pch_key = (struct symbol **) calloc(pch_mask + 1, sizeof(struct symbol *));
+	pch_idx = (int *) malloc(sizeof(int) * (pch_mask + 1));
+	if (!tab || !roots || !pch_key || !pch_idx)
+		asm_error("out of memory");
+	
+	// root level absolutes and types go first, copied out so no pages stay held
+	cnt = 0;
+	left = 0;
+	for (i = 0; i < sym_pages.count; i++) {
+		sym = left-- ? sym + 1 : (struct symbol *) page_run(&sym_pages, i, &left, 0);
+		if (sym->type == 4) {
+			roots[cnt] = *sym;
+			asm_pch_place(tab, &cnt, &roots[cnt]);
+		}
+	}
+	top = cnt;
+	
+	// then all of the field chains hanging off of them
+	for (i = 0; i < cnt; i++)
+		for (sym = tab[i]->parent; sym && asm_pch_find(sym) < 0; sym = sym->next)
+			asm_pch_place(tab, &cnt, sym);
+	
+	if (cnt > 0xFFFF)
+		asm_error("pch too large");
+	
+	// header
+	sio_out(PCH_MAGIC & 0xFF);
+	sio_out(PCH_MAGIC >> 8);
+	sio_out(PCH_VERSION);
+	sio_out(sizeof(struct symbol));
+	sio_out(cnt & 0xFF);
+	sio_out(cnt >> 8);
+	sio_out(top & 0xFF);
+	sio_out(top >> 8);
+	
+	// records
+	for (i = 0; i < cnt; i++) {
+		rec = *tab[i];
+		
+		// root level symbols are chained to each other, fields keep their chain
+		if (i < top)
+			j = (i + 1 < top) ? i + 2 : 0;
+		else
+			j = rec.next ? asm_pch_find(rec.next) + 1 : 0;
+		rec.next = (struct symbol *) (uintptr_t) j;
+		
+		j = rec.parent ? asm_pch_find(rec.parent) + 1 : 0;
+		rec.parent = (struct symbol *) (uintptr_t) j;
+		
+		b = (uint8_t *) &rec;
+		for (j = 0; j < sizeof(struct symbol); j++)
+			sio_out(b[j]);
+	}
+	
+	free(tab);
+	free(roots);
+	free(pch_key);
+	free(pch_idx);
+	pch_key = NULL;
+	pch_idx = NULL;
+}
+
+/*
+ * loads a precompiled header in one read, and fixes up the pointers in place
+ * root level symbols are copied onto the end of the root table
+ */
+void asm_pch_read()
+{
+	FILE *f;
+	long size;
+	uint8_t *buf;
+	struct symbol *rec;
+	uintptr_t n;
+	int cnt, top, i;
+	
+	if (!(f = fopen(pch_in, "rb")))
+		asm_error("cannot open pch");
+	
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	
+	buf = (uint8_t *) asm_alloc(size + 1);
+	if (size < PCH_HEAD_SIZE || fread(buf, size, 1, f) != 1)
+		asm_error("bad pch");
+	fclose(f);
+	
+	cnt = buf[4] + (buf[5] << 8);
+	top = buf[6] + (buf[7] << 8);
+	
+	if (buf[0] + (buf[1] << 8) != PCH_MAGIC || buf[2] != PCH_VERSION || buf[3] != sizeof(struct symbol) ||
+		top > cnt || size != PCH_HEAD_SIZE + (long) cnt * sizeof(struct symbol))
+		asm_error("bad pch");
+	
+	rec = (struct symbol *) (buf + PCH_HEAD_SIZE);
+	
+	// indicies -> pointers
+	for (i = 0; i < cnt; i++) {
+		if ((n = (uintptr_t) rec[i].next) > cnt || (uintptr_t) rec[i].parent > cnt)
+			asm_error("bad pch");
+		
+		rec[i].next = n ? &rec[n - 1] : NULL;
+		n = (uintptr_t) rec[i].parent;
+		rec[i].parent = n ? &rec[n - 1] : NULL;
+	}
+	
+	// add to the root table, fields stay where they are
+	for (i = 0; i < top; i++) {
+		*(struct symbol *) page_add(&sym_pages) = rec[i];
+		asm_sym_index(sym_pages.count - 1, rec[i].name);
+	}
+	sym_count += cnt;
+	z80_use[ZU_SYM] += (long) Z80_SYMBOL * (page_limited() ? cnt - top : cnt);
+	z80_use[ZU_INDEX] += (long) Z80_SINDEX * top;
+}
+
 /*
  * resets all allocation stuff
  */
 void asm_reset()
-{	
+{
+	int i;
+	
+	// drop everything from the last assembly
+	asm_release();
+	page_reset();
 	
 	sym_table = NULL;
-	loc_table = NULL;
 	glob_table = NULL;
 	
-	// allocate empty table
+	// allocate empty tables
 	sym_table = (struct symbol *) asm_alloc(sizeof(struct symbol));
 	sym_table->parent = NULL;
+	page_init(&sym_pages, sizeof(struct symbol), Z80_SYMBOL);
+	page_init(&loc_pages, sizeof(struct local), Z80_LOCAL);
+	
+	// and their indices
+	for (i = 0; i < SYM_HASH; i++)
+		sym_head[i] = sym_tail[i] = -1;
+	for (i = 0; i < LOC_LABELS; i++)
+		loc_idx[i].n = 0;
 	
 	asm_sym_update(sym_table, "sys", 1, NULL, 0x0005);
 	asm_sym_update(sym_table, "header", 1, NULL, 0x0000);
@@ -518,6 +1136,11 @@ void asm_reset()
 	loc_count = 0;
 	glob_count = 0;
 	reloc_count = 0;
+	memset(z80_use, 0, sizeof(z80_use));
+	
+	// preload precompiled header
+	if (pch_in)
+		asm_pch_read();
 	
 	// externs start at 5
 	extn = 5;
@@ -532,24 +1155,36 @@ void asm_reset()
  */
 void asm_local_add(uint8_t label, uint8_t type, uint16_t value)
 {
-	struct local *new, *curr;
+	struct local *new;
+	struct lindex *l;
+	
+	// when the first pass is run again, the local is already there
+	if (loc_redo >= 0 && loc_redo < loc_pages.count) {
+		new = (struct local *) page_get(&loc_pages, loc_redo++, 1);
+		new->type = type;
+		new->value = value;
+		return;
+	}
 	
 	// alloc the new local symbol
 	loc_count++;
-	new = (struct local *) asm_alloc(sizeof(struct local));
+	new = (struct local *) page_add(&loc_pages);
 	new->label = label;
 	new->type = type;
 	new->value = value;
 	
-	// append to local table
-	if (loc_table) {
-		curr = loc_table;
-		while (curr->next)
-			curr = curr->next;
-		
-		curr->next = new;
-	} else
-		loc_table = new;
+	// and index it by label
+	l = &loc_idx[label];
+	if (l->n == l->size) {
+		l->size = l->size ? l->size * 2 : 64;
+		if (!(l->rec = (int *) realloc(l->rec, sizeof(int) * l->size)))
+			asm_error("out of memory");
+	}
+	l->rec[l->n++] = loc_pages.count - 1;
+	
+	if (!page_limited())
+		asm_z80_take(ZU_LOC, Z80_LOCAL);
+	asm_z80_take(ZU_INDEX, Z80_LINDEX);
 }
 
 /*
@@ -561,34 +1196,38 @@ void asm_local_add(uint8_t label, uint8_t type, uint16_t value)
  */
 char asm_local_fetch(uint16_t *result, int index, uint8_t label, char dir)
 {
-	struct local *curr, *last;
+	struct local *curr;
+	struct lindex *l;
+	int lo, hi, mid;
 	
-	curr = loc_table;
+	stat_llookups++;
 	
-	// iterate through list
-	last = NULL;
-	while (curr) {
-		
-		// label match
-		if (curr->label == label) {
-			if (index) {
-				last = curr;
-			} else break;
-		}
-		
-		if (index) index--;
-		curr = curr->next;
+	*result = 0;
+	if (label >= LOC_LABELS)
+		return 0;
+	
+	// find the first local with the label at or past the index
+	l = &loc_idx[label];
+	lo = 0;
+	hi = l->n;
+	while (lo < hi) {
+		stat_lprobes++;
+		mid = (lo + hi) / 2;
+		if (l->rec[mid] < index)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 	
-	if (dir)
-		last = curr;
+	// backwards wants the one before it
+	if (!dir)
+		lo--;
+	if (lo < 0 || lo >= l->n)
+		return 0;
 	
-	*result = 0;
-	if (last) {
-		*result = last->value;
-		return last->type;
-	}
-	return 0;
+	curr = (struct local *) page_get(&loc_pages, l->rec[lo], 0);
+	*result = curr->value;
+	return curr->type;
 }
 
 /*
@@ -596,14 +1235,18 @@ char asm_local_fetch(uint16_t *result, int index, uint8_t label, char dir)
  *
  * sym = symbol to add
  */
-void asm_glob(struct symbol *sym) 
+void asm_glob(int rec) 
 {
 	struct global *curr, *new;
 	
 	glob_count++;
+	asm_z80_take(ZU_GLOB, Z80_GLOBAL);
 	glob_rec++;
+	
+	// the symbol is kept by record number, it can still be paged out
 	new = (struct global *) asm_alloc(sizeof(struct global));
-	new->symbol = sym;
+	new->rec = rec;
+	memcpy(new->name, ((struct symbol *) page_get(&sym_pages, rec, 0))->name, SYMBOL_NAME_SIZE);
 	new->next = NULL;
 	
 	curr = NULL;
@@ -612,7 +1255,7 @@ void asm_glob(struct symbol *sym)
 		
 		while (1) {
 			// if the symbol already is glob, just ignore it
-			if (curr->symbol == sym)
+			if (curr->rec == rec)
 				return;
 			
 			if (curr->next) {
@@ -670,6 +1313,7 @@ void asm_reloc(struct header *tab, uint16_t addr, uint8_t type)
 	tab->index = i;
 	tab->last = addr;
 	reloc_rec++;
+	stat_relocs++;
 }
 
 
@@ -962,6 +1606,7 @@ uint8_t asm_evaluate(uint16_t *result, char itok)
 	
 	// reset indicies
 	vindex = eindex = 0;
+	stat_exprs++;
 	
 	while (1) {
 		// read token, or use inital token
@@ -1005,7 +1650,7 @@ uint8_t asm_evaluate(uint16_t *result, char itok)
 			}
 			
 			// parse subtypes for symbols
-			while (sio_peek() == '.') {
+			while (asm_peek() == '.') {
 				
 				asm_token_read();
 				tok = asm_token_read();
@@ -1044,16 +1689,17 @@ uint8_t asm_evaluate(uint16_t *result, char itok)
 			op = 0;
 			
 			// escape character
-			if (sio_peek() == '\\') {
-				sio_next();
-				num = asm_escape_char(sio_next());
+			if (tok_cur.text[0] == '\\') {
+				if (tok_cur.text[1] == -1)
+					asm_error("unterminated escape");
+				num = asm_escape_char(tok_cur.text[1]);
 				
 				if (!num) asm_error("unknown escape");
 			} else {
-				num = sio_next();
+				num = tok_cur.text[0];
 			}
 			
-			if (asm_token_read() != '\'')
+			if (!(tok_cur.flags & LEX_CLOSED))
 				asm_error("expected \'");
 		} else {
 			// it is a token (hopefully mathematic)
@@ -1064,7 +1710,7 @@ uint8_t asm_evaluate(uint16_t *result, char itok)
 				tok == '^' || tok == '(' || tok == ')') op = tok;
 				
 			if (tok == '>' || tok == '<') {
-				if (tok != sio_peek()) op = -1;
+				if (tok != asm_peek()) op = -1;
 				else op = tok;
 				
 				asm_token_read();
@@ -1100,7 +1746,7 @@ uint8_t asm_evaluate(uint16_t *result, char itok)
 		}
 		
 		// check for ending conditions
-		tok = sio_peek();
+		tok = asm_peek();
 		if (tok == ',' || tok == '\n' || tok == ']' || tok == '}' || tok == -1) break;
 		if (tok == ')' && !exp_estack_has_lpar(eindex)) break;
 			
@@ -1129,7 +1775,7 @@ uint16_t asm_bracket(char nofail)
 	char res;
 	
 	// if there is no bracket, just return 0
-	if (sio_peek() != '[')
+	if (asm_peek() != '[')
 		return 0;
 	
 	asm_token_read();
@@ -1152,6 +1798,126 @@ uint16_t asm_bracket(char nofail)
 	return result;
 }
 
+/*
+ * starts a new line table row if a text byte comes from a different line than the last
+ * the header is left out
+ */
+void asm_line_mark()
+{
+	struct lrow *r;
+	
+	if (asm_address < 16)
+		return;
+	
+	if (line_n) {
+		r = &line_row[line_n - 1];
+		if (r->file == tok_cur.file && r->line == tok_cur.line)
+			return;
+	}
+	
+	if (line_n == line_size) {
+		line_size = line_size ? line_size * 2 : 256;
+		if (!(line_row = (struct lrow *) realloc(line_row, sizeof(struct lrow) * line_size))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+	}
+	
+	asm_z80_entry(ZU_LINE, line_n, Z80_LINE);
+	r = &line_row[line_n++];
+	r->addr = asm_address;
+	r->file = tok_cur.file;
+	r->line = tok_cur.line;
+}
+
+/*
+ * writes a number into a buffer 7 bits at a time, lowest first
+ * the top bit of each byte is set if more follow
+ *
+ * b = buffer
+ * v = number
+ * returns bytes written
+ */
+int asm_vlq(uint8_t *b, uint32_t v)
+{
+	int n;
+	
+	n = 0;
+	while (v > 0x7F) {
+		b[n++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	b[n++] = v;
+	
+	return n;
+}
+
+/*
+ * writes out the line table as an extension record
+ * each row is the address delta, then the line delta (zigzagged and shifted up 1)
+ * the low bit of the second number is set if the file index follows
+ */
+void asm_line_out()
+{
+	uint8_t *buf;
+	int i, n, size, file, line;
+	uint16_t addr;
+	uint32_t zz;
+	char *name;
+	
+	// names and rows together can never be bigger than this
+	size = 1;
+	for (i = 1; i < sio_count(); i++)
+		size += strlen(sio_name(i)) + 1;
+	size += line_n * 12;
+	buf = (uint8_t *) malloc(size);
+	if (!buf) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	
+	// file names, in argument order
+	n = 0;
+	buf[n++] = sio_count() - 1;
+	for (i = 1; i < sio_count(); i++) {
+		name = sio_name(i);
+		strcpy((char *) buf + n, name);
+		n += strlen(name) + 1;
+	}
+	
+	// rows
+	addr = 0;
+	file = 0;
+	line = 0;
+	for (i = 0; i < line_n; i++) {
+		n += asm_vlq(buf + n, (uint16_t) (line_row[i].addr - addr));
+		
+		// negative deltas are odd, positive ones even
+		if (line_row[i].line < line)
+			zz = (uint32_t) (line - line_row[i].line) * 2 - 1;
+		else
+			zz = (uint32_t) (line_row[i].line - line) * 2;
+		n += asm_vlq(buf + n, (zz << 1) | (line_row[i].file - 1 != file));
+		if (line_row[i].file - 1 != file)
+			buf[n++] = line_row[i].file - 1;
+		
+		addr = line_row[i].addr;
+		file = line_row[i].file - 1;
+		line = line_row[i].line;
+	}
+	
+	if (n > 0xFFFF)
+		asm_error("line table too large");
+	
+	sio_out(EXT_LINES);
+	sio_out(n & 0xFF);
+	sio_out(n >> 8);
+	for (i = 0; i < n; i++)
+		sio_out(buf[i]);
+	
+	free(buf);
+}
+
 /*
  * emits a byte into assembly output
  * no bytes emitted on first pass, only indicies updated
@@ -1160,9 +1926,19 @@ uint16_t asm_bracket(char nofail)
  */
 void asm_emit(uint8_t b)
 {
+	if (isr_n < 4)
+		isr_bytes[isr_n++] = b;
+	
 	if (asm_pass) {
+		stat_seg[asm_seg & 3]++;
+		
+		if (list_active())
+			list_byte(asm_seg, asm_address - seg_base[asm_seg & 3], b);
+		
 		switch (asm_seg) {
 			case 1:
+				if (asm_lines)
+					asm_line_mark();
 				sio_out((char) b);
 				break;
 				
@@ -1194,7 +1970,45 @@ void asm_emit_word(uint16_t w) {
 }
 
 /*
- * emits a string found in the char stream
+ * returns the next raw character of the string being read
+ * the end of the string reads as the closing ", or -1 if there is not one
+ */
+char asm_str_next()
+{
+	// move on to the rest of a long string
+	while (str_i >= tok_cur.len && asm_ahead(0)->type == LEX_MORE) {
+		asm_token_read();
+		str_i = 0;
+	}
+	
+	if (str_i < tok_cur.len)
+		return tok_cur.text[str_i++];
+	
+	return (tok_cur.flags & LEX_CLOSED) ? '"' : -1;
+}
+
+/*
+ * returns what asm_str_next() would but does not move forward
+ */
+char asm_str_peek()
+{
+	struct token *t;
+	
+	if (str_i < tok_cur.len)
+		return tok_cur.text[str_i];
+	
+	t = asm_ahead(0);
+	if (t->type == LEX_MORE) {
+		if (t->len)
+			return t->text[0];
+		return (t->flags & LEX_CLOSED) ? '"' : -1;
+	}
+	
+	return (tok_cur.flags & LEX_CLOSED) ? '"' : -1;
+}
+
+/*
+ * emits a string found in the token stream
  */
 void asm_emit_string()
 {
@@ -1205,12 +2019,14 @@ void asm_emit_string()
 	// zero state, just accept raw characters
 	state = 0;
 	
-	sio_next();
+	asm_token_read();
+	str_i = 0;
 	while (1) {
-		c = sio_next();
+		c = asm_str_next();
 		
-		// we are done (maybe)
-		if (c == -1) break;
+		// the source ended first
+		if (c == -1)
+			asm_error(state == 1 ? "unterminated escape" : "unterminated string");
 		if (c == '"') {
 			if (state != 1) {
 				if (state == 3) {
@@ -1260,7 +2076,7 @@ void asm_emit_string()
 			
 			decode = (decode * radix) + num;
 			
-			num = asm_classify_radix(sio_peek());
+			num = asm_classify_radix(asm_str_peek());
 			length--;
 			
 			// end the parsing
@@ -1273,9 +2089,6 @@ void asm_emit_string()
 		// this is to consume the 'x' identifier 
 		if (state == 2) state = 3;
 	}
-	
-	// make sure we don't land in whitespace
-	asm_wskip();
 }
 
 /*
@@ -1318,8 +2131,9 @@ void asm_emit_addr(uint16_t size, uint16_t value, uint8_t type)
 		
 		if (type > 0 && type < 4) {
 			// emit a relative address
+			// only checked on the second pass, until then labels past here can be left over from a rerun
 			rel = (value - asm_address) - 1;
-			if (rel < 0x80 || rel > 0xFF7F)
+			if (rel < 0x80 || rel > 0xFF7F || !asm_pass)
 				asm_emit(rel);
 			else
 				asm_error("relative out of bounds");
@@ -1330,6 +2144,8 @@ void asm_emit_addr(uint16_t size, uint16_t value, uint8_t type)
 	} else {
 		
 		if (((type > 0 && type < 4) || type > 4) && asm_pass) {
+			if (type > 4)
+				isr_ext = type;
 			
 			// relocate!
 			switch (asm_seg) {
@@ -1338,7 +2154,7 @@ void asm_emit_addr(uint16_t size, uint16_t value, uint8_t type)
 					break;
 					
 				case 2:
-					asm_reloc(&datar, asm_address - text_top, type);
+					asm_reloc(&datar, asm_address - seg_base[2], type);
 					break;
 					
 				default:
@@ -1404,7 +2220,7 @@ void asm_define_type(struct symbol *type)
 			asm_error("field domain overrun");
 		asm_fill((base + sym->value) - asm_address);
 		
-		tok = sio_peek();
+		tok = asm_peek();
 		if (tok == '"') {
 			// emit the string
 			asm_emit_string();
@@ -1456,8 +2272,8 @@ void asm_define(char *type, uint16_t count)
 	addr = asm_address;
 	
 	i = 0;
-	while (sio_peek() != '\n' && sio_peek() != -1) {
-		tok = sio_peek();
+	while (asm_peek() != '\n' && asm_peek() != -1) {
+		tok = asm_peek();
 		if (tok == '"') {
 			// emit the string
 			asm_emit_string();
@@ -1479,7 +2295,7 @@ void asm_define(char *type, uint16_t count)
 		asm_fill(addr - asm_address);
 		
 
-		if (sio_peek() != '\n' && sio_peek() != -1) asm_expect(',');
+		if (asm_peek() != '\n' && asm_peek() != -1) asm_expect(',');
 	}
 	
 	// do count handling
@@ -1503,8 +2319,8 @@ void asm_type(char *name)
 	
 	asm_expect('{');
 	
-	if (asm_pass) {
-		while (sio_peek() != '}' && sio_peek() != -1)
+	if (asm_pass || asm_rerun) {
+		while (asm_peek() != '}' && asm_peek() != -1)
 			asm_token_read();
 		
 		asm_expect('}');
@@ -1543,7 +2359,7 @@ void asm_type(char *name)
 
 		base += size * count;
 		
-		if (sio_peek() == ',')
+		if (asm_peek() == ',')
 			asm_expect(',');
 		else
 			break;
@@ -1568,7 +2384,7 @@ uint8_t asm_arg(uint16_t *con, uint8_t eval) {
 	uint8_t ret, type;
 	
 	// check if there is anything next
-	if (sio_peek() == '\n' || sio_peek() == -1)
+	if (asm_peek() == '\n' || asm_peek() == -1)
 		return 255;
 	
 	// assume at plain expression at first
@@ -1627,7 +2443,7 @@ uint8_t asm_arg(uint16_t *con, uint8_t eval) {
 		
 		// check for ix and iy
 		else if (asm_sequ(token_buf, "ix")) {
-			if (sio_peek() == '+') {
+			if (asm_peek() == '+') {
 				// its got a constant
 				asm_token_read();
 				tok = 0;
@@ -1637,7 +2453,7 @@ uint8_t asm_arg(uint16_t *con, uint8_t eval) {
 				return 29;
 			}
 		} else if (asm_sequ(token_buf,"iy")) {
-			if (sio_peek() == '+') {
+			if (asm_peek() == '+') {
 				// its got a constant
 				asm_token_read();
 				tok = 0;
@@ -1654,24 +2470,201 @@ uint8_t asm_arg(uint16_t *con, uint8_t eval) {
 		}
 	}
 	
-	// ok, its an expression
-	if (eval) {
-		type = asm_evaluate(con, tok);
-		if (type == 0) {
-			*con = 0;
-			if (asm_pass)
-				asm_error("undefined symbol");
-		} else if (type != 4)
-			asm_error("must be absolute");
-		
-		// if not 29, needs a trailing ')'
-		if (ret != 31)
-			asm_expect(')');
-	} else {
-		// hack to return tok so the caller can run asm_emit_exp
-		*con = tok;
+	// ok, its an expression
+	if (eval) {
+		type = arg_type = asm_evaluate(con, tok);
+		if (type == 0) {
+			*con = 0;
+			if (asm_pass)
+				asm_error("undefined symbol");
+		} else if (type != 4)
+			asm_error("must be absolute");
+		
+		// if not 29, needs a trailing ')'
+		if (ret != 31)
+			asm_expect(')');
+	} else {
+		// hack to return tok so the caller can run asm_emit_exp
+		*con = tok;
+	}
+	return ret;
+}
+
+/*
+ * makes sure a table of first pass choices has room for an entry
+ * new entries start out as 0
+ *
+ * tab = pointer to table
+ * size = pointer to table size
+ * n = entry needed
+ */
+void asm_grow(char **tab, int *size, int n)
+{
+	int i;
+	
+	if (n < *size)
+		return;
+	
+	i = *size;
+	*size = *size ? *size * 2 : 256;
+	if (!(*tab = (char *) realloc(*tab, *size)))
+		asm_error("out of memory");
+	
+	for (; i < *size; i++)
+		(*tab)[i] = 0;
+}
+
+/*
+ * emits a jump that is relative if the target is close enough, and absolute if not
+ * the choice is made on the first pass, and only ever goes from relative to absolute
+ *
+ * cond = condition (0 = nz, 1 = z, 2 = nc, 3 = c, 4 = po, 5 = pe, 6 = p, 7 = m), or -1
+ * value = target address
+ * type = target type
+ */
+void asm_jmp(int cond, uint16_t value, uint8_t type)
+{
+	int n, dist;
+	
+	n = jmp_cnt++;
+	asm_grow(&jmp_long, &jmp_size, n);
+	asm_z80_entry(ZU_JMP, n, Z80_JMP);
+	
+	if (!asm_pass && !jmp_long[n]) {
+		dist = (int16_t) (value - (asm_address + 2));
+		
+		if (!type) {
+			// not seen yet, assume it will be close for now
+			if (!asm_rerun)
+				jmp_unknown++;
+		} else if (cond > 3 || type != asm_seg || dist < -128 || dist > 127) {
+			jmp_long[n] = 1;
+			jmp_flips++;
+		}
+	}
+	
+	if (jmp_long[n]) {
+		asm_emit(cond < 0 ? 0xC3 : 0xC2 + (cond << 3));
+		asm_emit_addr(2, value, type);
+	} else {
+		asm_emit(cond < 0 ? 0x18 : 0x20 + (cond << 3));
+		asm_emit_addr(1, value, type);
+	}
+}
+
+/*
+ * checks if a constant operand is zero, for rules that swap in a shorter instruction
+ * the choice is made on the first pass, as the constant may not be defined until later
+ *
+ * rule = peephole rule
+ * value = constant value
+ * type = constant type
+ * returns 1 if the rule should be used
+ */
+char asm_peep_zero(int rule, uint16_t value, uint8_t type)
+{
+	int n;
+	
+	if (!asm_opt)
+		return 0;
+	
+	n = peep_cnt++;
+	asm_grow(&peep_zero, &peep_size, n);
+	asm_z80_entry(ZU_PEEP, n, Z80_PEEP);
+	
+	if (!asm_pass)
+		peep_zero[n] = type == 4 && !value;
+	else if (peep_zero[n])
+		peep_hits[rule]++;
+	
+	return peep_zero[n];
+}
+
+/*
+ * checks if the next line holds nothing but a given instruction, so it can be folded into this one
+ * if so, the next line is skipped over once this one is done
+ *
+ * rule = peephole rule
+ * mnem = mnemonic of next instruction
+ * reg = operand of next instruction, or NULL if it has none
+ * returns 1 if the rule should be used
+ */
+char asm_peep_next(int rule, char *mnem, char *reg)
+{
+	struct token *t;
+	int n;
+	
+	if (!asm_opt || asm_ahead(0)->type != 'n')
+		return 0;
+	
+	t = asm_ahead(1);
+	if (t->type != 'a' || !asm_sequ(t->text, mnem))
+		return 0;
+	
+	n = 2;
+	if (reg) {
+		t = asm_ahead(n++);
+		if (t->type != 'a' || !asm_sequ(t->text, reg))
+			return 0;
+	}
+	
+	t = asm_ahead(n);
+	if (t->type != 'n' && t->type != -1)
+		return 0;
+	
+	if (asm_pass)
+		peep_hits[rule]++;
+	
+	peep_skip = 1;
+	return 1;
+}
+
+/*
+ * checks if a jump target is a label on the very next line, so the jump can be left out
+ * only a plain symbol or forward local will match, anything else is left alone
+ *
+ * tok = type of target token, its text is in token_buf
+ * returns 1 if the jump should be left out
+ */
+char asm_peep_fall(char tok)
+{
+	struct token *t;
+	
+	if (!asm_opt || asm_ahead(0)->type != 'n' || asm_ahead(2)->type != ':')
+		return 0;
+	
+	t = asm_ahead(1);
+	if (t->type != tok)
+		return 0;
+	
+	if (tok == 'a') {
+		if (strcmp(t->text, token_buf))
+			return 0;
+	} else if (tok == '0') {
+		if (t->len != 1 || t->text[0] != token_buf[0] || token_buf[1] != 'f' || token_buf[2])
+			return 0;
+	} else
+		return 0;
+	
+	if (asm_pass)
+		peep_hits[PEEP_NEXT]++;
+	
+	return 1;
+}
+
+/*
+ * prints how many times each peephole rule was used
+ */
+void asm_peep_report()
+{
+	int i;
+	
+	for (i = 0; i < PEEP_RULES; i++) {
+		printf("%-28s%6d", peep_table[i].rule, peep_hits[i]);
+		if (peep_hits[i] && peep_table[i].differs)
+			printf("  changes behavior: %s", peep_table[i].differs);
+		printf("\n");
 	}
-	return ret;
 }
 
 /*
@@ -1758,8 +2751,13 @@ char asm_doisr(struct instruct *isr) {
 					asm_emit(con & 0xFF);
 			} else if (arg == 31) {
 				// constant
-				asm_emit(isr->opcode + 0x46);
-				asm_emit(con);
+				if (isr->opcode == 0xB8 && asm_peep_zero(PEEP_OR, con, arg_type)) {
+					// cp 0 -> or a
+					asm_emit(0xB7);
+				} else {
+					asm_emit(isr->opcode + 0x46);
+					asm_emit(con);
+				}
 			} else 
 				return 1;
 		} else if (prim == 1) {
@@ -1865,7 +2863,7 @@ char asm_doisr(struct instruct *isr) {
 			
 			arg = 6;
 			// its an undefined operation
-			if (sio_peek() == ',') {
+			if (asm_peek() == ',') {
 				asm_expect(',');
 				arg = asm_arg(&con, 1);
 				
@@ -1873,6 +2871,10 @@ char asm_doisr(struct instruct *isr) {
 				if (arg == 6)
 					arg = 8;
 			}
+		} else if (isr->opcode == 0x20 && arg == 5 && asm_peep_next(PEEP_ADD, "rl", "h")) {
+			// sla l / rl h -> add hl,hl
+			asm_emit(0x29);
+			return 0;
 		} else
 			asm_emit(0xCB);			
 	
@@ -1926,8 +2928,13 @@ char asm_doisr(struct instruct *isr) {
 			asm_expect(',');
 			asm_emit_expression(2, 0);
 		} else if (arg == 31) {
-			asm_emit(isr->opcode + 1);
-			asm_emit_expression(2, con);
+			if (asm_peep_fall(con)) {
+				// jp to the next line, just check the target
+				asm_evaluate(&value, con);
+			} else {
+				asm_emit(isr->opcode + 1);
+				asm_emit_expression(2, con);
+			}
 		} else if (arg == 6) {
 			asm_emit(isr->arg);
 		} else if (arg == 29) {
@@ -1971,8 +2978,26 @@ char asm_doisr(struct instruct *isr) {
 			asm_expect(',');
 			asm_emit_expression(2, 0);
 		} else if (arg == 31) {
-			asm_emit(isr->arg);
-			asm_emit_expression(2, con);
+			type = asm_evaluate(&value, con);
+			
+			// call x / ret -> jp x
+			asm_emit(asm_peep_next(PEEP_TAIL, "ret", NULL) ? 0xC3 : isr->arg);
+			asm_emit_addr(2, value, type);
+		} else
+			return 1;
+	}
+	
+	else if (isr->type == RELAX) {
+		// jr or jp
+		arg = asm_arg(&con, 0);
+		
+		if (arg >= 13 && arg <= 20) {
+			asm_expect(',');
+			type = asm_evaluate(&value, 0);
+			asm_jmp(arg - 13, value, type);
+		} else if (arg == 31) {
+			type = asm_evaluate(&value, con);
+			asm_jmp(-1, value, type);
 		} else
 			return 1;
 	}
@@ -2272,6 +3297,16 @@ char asm_doisr(struct instruct *isr) {
 				asm_emit(0x40 + (arg<<3) + reg);
 				if (prim)
 					asm_emit_imm(value, type);
+			} else if (arg == 7 && reg == 31) {
+				// *->a
+				type = asm_evaluate(&value, con);
+				if (asm_peep_zero(PEEP_XOR, value, type)) {
+					// ld a,0 -> xor a
+					asm_emit(0xAF);
+				} else {
+					asm_emit(0x3E);
+					asm_emit_imm(value, type);
+				}
 			} else if (arg < 8 && reg == 31) {
 				// *->reg8
 				asm_emit(0x06 + (arg<<3));
@@ -2403,6 +3438,116 @@ char asm_doisr(struct instruct *isr) {
 	return 0;
 }
 
+/*
+ * checks if an unprefixed opcode reads or writes (hl)
+ *
+ * op = opcode
+ * returns true (1) or false (0)
+ */
+char asm_cycles_mem(uint8_t op)
+{
+	if (op < 0x40 || op >= 0xC0 || op == 0x76)
+		return 0;
+	
+	return (op & 7) == 6 || (op >= 0x70 && op < 0x78);
+}
+
+/*
+ * works out the T-states for an 0xED prefixed opcode
+ *
+ * op = opcode after the prefix
+ * lo = where to put the T-states if a repeat is not taken
+ * returns T-states if a repeat is taken
+ */
+int asm_cycles_ed(uint8_t op, int *lo)
+{
+	if (op >= 0x40 && op < 0x80) {
+		switch (op & 7) {
+			case 0:
+			case 1:
+				return 12;
+			case 2:
+				return 15;
+			case 3:
+				return 20;
+			case 5:
+				return 14;
+			case 7:
+				if (op < 0x60)
+					return 9;
+				if (op == 0x67 || op == 0x6F)
+					return 18;
+				return 8;
+			default:
+				return 8;
+		}
+	}
+	
+	// block instructions
+	if ((op & 0xE4) == 0xA0) {
+		if (op & 0x10) {
+			*lo = 16;
+			return 21;
+		}
+		return 16;
+	}
+	
+	return 8;
+}
+
+/*
+ * works out how many T-states an instruction takes
+ *
+ * b = instruction bytes
+ * n = number of bytes
+ * lo = where to put the T-states if a branch is not taken
+ * returns T-states if a branch is taken
+ */
+int asm_cycles(uint8_t *b, int n, int *lo)
+{
+	uint8_t op;
+	int hi;
+	
+	*lo = 0;
+	if (!n)
+		return 0;
+	
+	op = b[0];
+	if (op == 0xCB) {
+		op = b[1];
+		hi = (op & 7) != 6 ? 8 : (op & 0xC0) == 0x40 ? 12 : 15;
+	} else if (op == 0xED) {
+		hi = asm_cycles_ed(b[1], lo);
+	} else if (op == 0xDD || op == 0xFD) {
+		// index registers, (hl) becomes (ix+*)
+		op = b[1];
+		if (op == 0xCB)
+			hi = (b[3] & 0xC0) == 0x40 ? 20 : 23;
+		else if (op == 0x34 || op == 0x35)
+			hi = 23;
+		else if (op == 0x36 || asm_cycles_mem(op))
+			hi = 19;
+		else
+			hi = cyc_table[op] + 4;
+	} else {
+		hi = cyc_table[op];
+		
+		// conditional branches
+		if (op == 0x10)
+			*lo = 8;
+		else if ((op & 0xE7) == 0x20)
+			*lo = 7;
+		else if ((op & 0xC7) == 0xC0)
+			*lo = 5;
+		else if ((op & 0xC7) == 0xC4)
+			*lo = 10;
+	}
+	
+	if (!*lo)
+		*lo = hi;
+	return hi;
+}
+
 /*
  * attempts to assemble an instruction assuming a symbol has just been tokenized
  *
@@ -2428,6 +3573,86 @@ char asm_instr(char *in)
 	return 0;
 }
 
+/*
+ * finds the name of an external
+ *
+ * type = type of external
+ * returns name, or NULL if there is no such external
+ */
+char *asm_ext_name(uint8_t type)
+{
+	struct global *glob;
+	
+	if (type < 5)
+		return NULL;
+	
+	for (glob = glob_table; glob; glob = glob->next) {
+		if (((struct symbol *) page_get(&sym_pages, glob->rec, 0))->type == type)
+			return glob->name;
+	}
+	
+	return NULL;
+}
+
+/*
+ * records the tokens of a block up to the matching .endr, and starts playing them back
+ * nothing in the block is assembled while it is being recorded
+ *
+ * count = number of times to repeat the block
+ * sym = record number of counter symbol, or -1
+ */
+void asm_rept(uint16_t count, int sym)
+{
+	struct rept *r;
+	struct token *t;
+	int depth;
+	char tok;
+	
+	if (rept_depth == REPT_DEPTH)
+		asm_error("too many nested .rept");
+	
+	r = &rept_stack[rept_depth];
+	r->n = 0;
+	r->z80 = 0;
+	depth = 0;
+	
+	while (1) {
+		tok = asm_token_read();
+		if (tok == -1)
+			asm_error("unpaired .rept");
+		
+		// keep track of nested blocks
+		t = asm_ahead(0);
+		if (tok == '.' && t->type == 'a') {
+			if (asm_sequ(t->text, "rept"))
+				depth++;
+			else if (asm_sequ(t->text, "endr") && !depth--)
+				break;
+		}
+		
+		if (r->n == r->size) {
+			r->size = r->size ? r->size * 2 : 256;
+			if (!(r->tok = (struct token *) realloc(r->tok, sizeof(struct token) * r->size)))
+				asm_error("out of memory");
+		}
+		r->tok[r->n++] = tok_cur;
+		r->z80 += Z80_TOKEN + tok_cur.len;
+		asm_z80_take(ZU_REPT, Z80_TOKEN + tok_cur.len);
+	}
+	
+	// the end of line after .endr is left for when the block is done
+	asm_token_read();
+	r->end = tok_cur;
+	
+	r->pos = 0;
+	r->iter = 0;
+	r->count = count;
+	r->sym = sym;
+	
+	if (count && r->n)
+		rept_depth++;
+}
+
 /*
  * changes segments for first pass segment top tracking
  *
@@ -2470,6 +3695,17 @@ void asm_change_seg(char next)
 	}
 }
 
+/*
+ * returns how much padding is needed to align an address
+ *
+ * addr = address to align
+ * align = alignment, as a power of 2
+ */
+uint16_t asm_align(uint16_t addr, uint8_t align)
+{
+	return -addr & ((1 << align) - 1);
+}
+
 /*
  * iterates through and fixes all segments for the second pass
  */
@@ -2477,10 +3713,11 @@ void asm_fix_seg()
 {
 	struct symbol *sym;
 	struct local *loc;
+	int i, left;
 	
-	sym = sym_table->parent;
-	
-	while (sym) {
+	left = 0;
+	for (i = 0; i < sym_pages.count; i++) {
+		sym = left-- ? sym + 1 : (struct symbol *) page_run(&sym_pages, i, &left, 1);
 		
 		// printf("fixed %s from %d:%d to ", sym->name, sym->type, sym->value);
 		
@@ -2495,12 +3732,11 @@ void asm_fix_seg()
 		}
 		
 		// printf("%d:%d\n", sym->type, sym->value);
-		
-		sym = sym->next;
 	}
 	
-	loc = loc_table;
-	while (loc) {
+	left = 0;
+	for (i = 0; i < loc_pages.count; i++) {
+		loc = left-- ? loc + 1 : (struct local *) page_run(&loc_pages, i, &left, 1);
 		
 		// printf("fixed $%d from %d:%d to ", loc->label, loc->type, loc->value);
 		
@@ -2515,8 +3751,6 @@ void asm_fix_seg()
 		}
 		
 		// printf("%d:%d\n", loc->type, loc->value);
-		
-		loc = loc->next;
 	}
 }
 
@@ -2528,6 +3762,7 @@ void asm_meta()
 	int i;
 	uint8_t lextn;
 	struct global *glob;
+	struct symbol *sym;
 	
 	// output size of reloc records
 	reloc_rec++;
@@ -2536,7 +3771,7 @@ void asm_meta()
 					
 	// output reloc table
 	asm_reloc_out(textr.head, 0);
-	asm_reloc_out(datar.head, text_top);
+	asm_reloc_out(datar.head, seg_base[2]);
 	
 	// output terminator
 	sio_out(0);
@@ -2554,25 +3789,41 @@ void asm_meta()
 		
 		// make sure that we aren't outputting the same external twice
 		// hard to do, but may be possible
-		if (glob->symbol->type > 4)
-			if (glob->symbol->type != lextn++)
+		sym = (struct symbol *) page_get(&sym_pages, glob->rec, 0);
+		if (sym->type > 4)
+			if (sym->type != lextn++)
 				asm_error("multiple external emissions");
 		
 		
 		// size-1 bytes for the name
 		i = 0;
 		while (i < SYMBOL_NAME_SIZE-1) {
-			sio_out(glob->symbol->name[i]);
+			sio_out(sym->name[i]);
 			i++;
 		}
 		// 1 for the type
-		sio_out(glob->symbol->type);
+		sio_out(sym->type);
 		// 2 for the value
-		sio_out(glob->symbol->value & 0xFF);
-		sio_out(glob->symbol->value >> 8);
+		sio_out(sym->value & 0xFF);
+		sio_out(sym->value >> 8);
 		
 		glob = glob->next;
 	}
+	
+	// output extension records
+	if (seg_align[1] || seg_align[2] || seg_align[3]) {
+		sio_out(EXT_ALIGN);
+		sio_out(3);
+		sio_out(0);
+		for (i = 1; i < 4; i++)
+			sio_out(seg_align[i]);
+	}
+	
+	if (asm_lines)
+		asm_line_out();
+	
+	if (seg_align[1] || seg_align[2] || seg_align[3] || asm_lines)
+		sio_out(EXT_END);
 }
 
 /*
@@ -2581,12 +3832,28 @@ void asm_meta()
 void asm_assemble(char flagg, char flagv)
 {
 	char tok, type, next;
-	int ifdepth, trdepth;
+	int ifdepth, trdepth, i;
 	uint16_t result, size;
+	long max;
 	struct symbol *sym;
+	struct global *glob;
+
+	// start timing
+	stat_reset();
+
+	// start reading tokens
+	lex_open(&tok_cur);
 
 	// reset data structures
 	asm_reset();
+	
+	// memory budget is kept per source, a precompiled header counts as its own
+	if (z80_budget) {
+		free(z80_mark);
+		if (!(z80_mark = (struct zmark *) calloc(sio_count(), sizeof(struct zmark))))
+			asm_error("out of memory");
+		asm_z80_check(0);
+	}
 
 	// start at pass 1
 	asm_pass = 0;
@@ -2607,11 +3874,33 @@ void asm_assemble(char flagg, char flagv)
 	// reset if and true depth
 	ifdepth = trdepth = 0;
 	
+	// nothing being repeated
+	rept_depth = 0;
+	
+	// no jumps relaxed yet
+	asm_rerun = 0;
+	loc_redo = -1;
+	jmp_cnt = jmp_flips = jmp_unknown = 0;
+	for (i = 0; i < jmp_size; i++)
+		jmp_long[i] = 0;
+	
+	// nor any peephole rules used
+	peep_cnt = peep_skip = 0;
+	for (i = 0; i < PEEP_RULES; i++)
+		peep_hits[i] = 0;
+	
+	// segments only need to be byte aligned to start
+	for (i = 0; i < 4; i++)
+		seg_align[i] = 0;
+	
 	// fill space for a.out header
 	asm_fill(16);
 	
 	// general line input stuff
 	while (1) {
+		// symbols handed out on the last line are done with
+		page_safe();
+		
 		// read the next 
 		tok = asm_token_read();
 		//if (tok != 'a') printf("reading: %c\n", tok);
@@ -2624,15 +3913,55 @@ void asm_assemble(char flagg, char flagv)
 				asm_error("unpaired .if");
 			
 			if (!asm_pass) {
+				// relaxed jumps moved things around, go again until they settle
+				if (jmp_flips || jmp_unknown) {
+					if (flagv)
+						printf("relaxing jumps, %d of %d made long\n", jmp_flips, jmp_cnt);
+					
+					asm_rerun = 1;
+					loc_redo = 0;
+					jmp_cnt = jmp_flips = jmp_unknown = 0;
+					peep_cnt = 0;
+					loc_cnt = 0;
+					
+					asm_address = 0;
+					asm_seg = 1;
+					text_top = data_top = bss_top = 0;
+					
+					lex_rewind(&tok_cur);
+					asm_fill(16);
+					continue;
+				}
+				
+				stat_mark(STAT_PASS1);
+				
 				// first pass -> second pass
 				if (flagv)
-					printf("first pass done, %d Z80 bytes used (%d:%d:%d:%d)\n", (18 * sym_count) + (6 * loc_count) + (4 * glob_count) + ((2 + RELOC_SIZE*2) * reloc_count), sym_count, loc_count, glob_count, reloc_count);
+					printf("first pass done, %ld Z80 bytes used (%d:%d:%d:%d)\n", asm_z80_used(), sym_count, loc_count, glob_count, reloc_count);
+				
+				// only the first pass is needed for a precompiled header
+				if (pch_out) {
+					asm_pch_write();
+					break;
+				}
+				
 				asm_pass++;
+				cfg_reset();
 				loc_cnt = 0;
+				jmp_cnt = 0;
+				peep_cnt = 0;
+				loc_redo = -1;
 				
-				// fix segment symbols
+				// pad text and data so the segment after each is aligned
 				asm_change_seg(1);
+				text_pad = asm_align(text_top, seg_align[2]);
+				text_top += text_pad;
+				data_pad = asm_align(text_top + data_top, seg_align[3]);
+				data_top += data_pad;
+				
+				// fix segment symbols
 				asm_fix_seg();
+				stat_mark(STAT_FIXSEG);
 				
 				// store bss_top for header emission
 				size = text_top + data_top + bss_top;
@@ -2643,7 +3972,11 @@ void asm_assemble(char flagg, char flagv)
 				asm_address = text_top = 0;
 				asm_seg = 1;
 				
-				sio_rewind();
+				seg_base[2] = data_top;
+				seg_base[3] = bss_top;
+				line_n = 0;
+				
+				lex_rewind(&tok_cur);
 				
 				// emit header
 				
@@ -2651,8 +3984,8 @@ void asm_assemble(char flagg, char flagv)
 				asm_emit(0x18);
 				asm_emit(0x0E);
 				
-				// info byte
-				asm_emit(0x01);
+				// info byte, extension records are only needed for alignment and lines
+				asm_emit(seg_align[1] || seg_align[2] || seg_align[3] || asm_lines ? 0x01 | H_EXT : 0x01);
 				
 				// text base
 				asm_emit(0x00);
@@ -2676,16 +4009,49 @@ void asm_assemble(char flagg, char flagv)
 				// bss top
 				asm_emit_word(size);
 				
+				// the header is not part of any line
+				list_clear();
 				
 				continue;
 			} else {
 				// emit relocation data and symbol stuff
 				if (flagv)
-					printf("second pass done, %d Z80 bytes used (%d:%d:%d:%d)\n", (18 * sym_count) + (6 * loc_count) + (4 * glob_count)  + ((2 + RELOC_SIZE*2) * reloc_count), sym_count, loc_count, glob_count, reloc_count);
+					printf("second pass done, %ld Z80 bytes used (%d:%d:%d:%d)\n", asm_z80_used(), sym_count, loc_count, glob_count, reloc_count);
+				if (flagv && asm_opt)
+					asm_peep_report();
+				if (z80_budget)
+					asm_z80_report();
+				
+				// check cycle budgets
+				if (cfg_check(flagv))
+					asm_abort();
+				
+				// report stack use of each global routine
+				if (asm_stack) {
+					for (glob = glob_table; glob; glob = glob->next) {
+						sym = (struct symbol *) page_get(&sym_pages, glob->rec, 0);
+						if (sym->type == 1)
+							stk_report(glob->name, sym->value, asm_stack > 1);
+					}
+					stk_done(asm_stack > 1);
+				}
+				
+				// fill in the padding at the ends of text and data
+				asm_change_seg(1);
+				asm_seg = 1;
+				asm_fill(text_pad);
+				asm_change_seg(2);
+				asm_seg = 2;
+				asm_fill(data_pad);
+				list_clear();
+				
+				stat_mark(STAT_PASS2);
 				sio_append();
+				stat_mark(STAT_APPEND);
 				
 				// output metablock
 				asm_meta();
+				stat_mark(STAT_META);
 				
 				break;
 			}
@@ -2766,11 +4132,11 @@ void asm_assemble(char flagg, char flagv)
 							asm_error("undefined symbol");
 						if (sym->type > 4)
 							asm_error("symbol is external");
-						asm_glob(sym);
+						asm_glob(sym_rec);
 					}
 					
 					// see if there is another
-					if (sio_peek() == ',')
+					if (asm_peek() == ',')
 						asm_expect(',');
 					else
 						break;
@@ -2785,22 +4151,22 @@ void asm_assemble(char flagg, char flagv)
 					tok = asm_token_read();
 					if (tok != 'a') 
 						asm_error("expected symbol");
-					if (!asm_pass) {
+					if (!asm_pass && !asm_rerun) {
 						
 						if (!extn)
 							asm_error("out of externals");
 		
 						// create external symbol, and increment extern counter
-						sym = asm_sym_update(sym_table, token_buf, extn++, NULL, 0);
+						asm_sym_update(sym_table, token_buf, extn++, NULL, 0);
 		
 						// output extern to the global table
 						// this will ensure that it is outputted so the linker can see it
-						asm_glob(sym);
+						asm_glob(sym_rec);
 						
 					}
 					
 					// see if there is another
-					if (sio_peek() == ',')
+					if (asm_peek() == ',')
 						asm_expect(',');
 					else
 						break;
@@ -2842,6 +4208,90 @@ void asm_assemble(char flagg, char flagv)
 				asm_eol();
 			}
 			
+			// repeat directive
+			else if (asm_sequ(token_buf, "rept")) {
+				type = asm_evaluate(&result, 0);
+				if (type != 4)
+					asm_error("must be absolute");
+				
+				// counter symbol
+				i = -1;
+				if (asm_peek() == ',') {
+					asm_expect(',');
+					if (asm_token_read() != 'a')
+						asm_error("expected symbol");
+					asm_sym_update(sym_table, token_buf, 4, NULL, 0);
+					i = sym_rec;
+				}
+				
+				asm_eol();
+				asm_rept(result, i);
+			}
+			
+			// only reached if there was no .rept
+			else if (asm_sequ(token_buf, "endr")) {
+				asm_error("unpaired .endr");
+			}
+			
+			// cycle budget directive
+			else if (asm_sequ(token_buf, "assert_cycles")) {
+				// start and end
+				type = asm_evaluate(&result, 0);
+				if (asm_pass && type != 1)
+					asm_error("must be in text");
+				asm_expect(',');
+				i = result;
+				type = asm_evaluate(&result, 0);
+				if (asm_pass && type != 1)
+					asm_error("must be in text");
+				asm_expect(',');
+				size = result;
+				
+				// most T-states allowed, a number on its own can go past 16 bits
+				tok = asm_token_read();
+				if (tok == '0' && !(token_buf[1] == 'f' || token_buf[1] == 'b') && (asm_peek() == '\n' || asm_peek() == -1)) {
+					max = asm_num_long(token_buf);
+				} else {
+					type = asm_evaluate(&result, tok);
+					if (type != 4)
+						asm_error("must be absolute");
+					max = result;
+				}
+				
+				if (asm_pass)
+					cfg_assert(tok_cur.file, tok_cur.line, i, size, max);
+				asm_eol();
+			}
+			
+			// loop bound directive
+			else if (asm_sequ(token_buf, "loop")) {
+				type = asm_evaluate(&result, 0);
+				if (type != 4)
+					asm_error("must be absolute");
+				
+				if (asm_pass)
+					cfg_loop(result);
+				asm_eol();
+			}
+			
+			// align directive
+			else if (asm_sequ(token_buf, "align")) {
+				type = asm_evaluate(&result, 0);
+				if (type != 4)
+					asm_error("must be absolute");
+				
+				for (i = 0; i < 16 && (1 << i) != result; i++);
+				if (i == 16)
+					asm_error("not a power of 2");
+				
+				if (i > seg_align[(int) asm_seg])
+					seg_align[(int) asm_seg] = i;
+				
+				// every segment starts out aligned, so only the address matters
+				asm_fill(asm_align(asm_address, i));
+				asm_eol();
+			}
+			
 			// type directive
 			else if (asm_sequ(token_buf, "type")) {
 				tok = asm_token_read();
@@ -2866,10 +4316,25 @@ void asm_assemble(char flagg, char flagv)
 		else if (tok == 'a')  {
 			
 			// try to get the type of the symbol
-			if (asm_instr(token_buf)) {
+			isr_n = isr_ext = 0;
+			if (peep_skip) {
+				// already folded into the last instruction
+				peep_skip = 0;
+				asm_skip();
+			} else if (asm_instr(token_buf)) {
 				// it's an instruction
+				if (asm_pass && isr_n) {
+					result = asm_cycles(isr_bytes, isr_n, &i);
+					if (list_active())
+						list_cycles(result, i);
+					
+					// code is kept for checking cycle budgets
+					if (asm_seg == 1)
+						cfg_isr(asm_address - isr_n, isr_bytes, isr_n, result, i, asm_ext_name(isr_ext));
+				}
+				
 				asm_eol();
-			} else if (sio_peek() == '=') {
+			} else if (asm_peek() == '=') {
 				// it's a symbol definition
 				asm_token_cache(sym_name);
 				asm_token_read();
@@ -2880,17 +4345,21 @@ void asm_assemble(char flagg, char flagv)
 				// set the new symbol
 				asm_sym_update(sym_table, sym_name, type, NULL, result);
 				asm_eol();
-			} else if (sio_peek() == ':') {
+			} else if (asm_peek() == ':') {
 				// it's a label
 				
+				// only code gets cycle totals
+				if (asm_pass && asm_seg == 1 && list_active())
+					list_label(token_buf);
+				
 				// set the new symbol (if it is the first pass)
 				if (!asm_pass) {
 					asm_sym_update(sym_table, token_buf, asm_seg, NULL, asm_address);
 					
 					// auto globals?
-					if (flagg) {
-						sym = asm_sym_fetch(sym_table, token_buf);
-						asm_glob (sym);
+					if (flagg && !asm_rerun) {
+						asm_sym_fetch(sym_table, token_buf);
+						asm_glob(sym_rec);
 					}
 				}
 				
@@ -2917,4 +4386,6 @@ void asm_assemble(char flagg, char flagv)
 			asm_error("unexpected token");
 		}
 	}
+	
+	lex_close();
 }
\ No newline at end of file
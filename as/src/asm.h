@@ -3,16 +3,65 @@
 
 /* includes */
 #include <stdint.h>
+#include <setjmp.h>
+
+#include "lex.h"
 
 /* defines */
 
 #define EXP_STACK_DEPTH 16
 
-#define TOKEN_BUF_SIZE 19
 #define SYMBOL_NAME_SIZE 9
 
 #define RELOC_SIZE 8
 
+#define CHUNK_SIZE 4096
+
+#define REPT_DEPTH 8
+
+/* size of each table entry on a Z80 */
+#define Z80_SYMBOL 18
+#define Z80_LOCAL 6
+#define Z80_GLOBAL 4
+#define Z80_RELOC (2 + RELOC_SIZE*2)
+#define Z80_TOKEN 6 // plus the text
+#define Z80_JMP 1
+#define Z80_PEEP 1
+#define Z80_LINE 5
+#define Z80_SINDEX 4
+#define Z80_LINDEX 2
+
+/* tables counted against the Z80 budget */
+#define ZU_SYM 0
+#define ZU_LOC 1
+#define ZU_GLOB 2
+#define ZU_RELOC 3
+#define ZU_REPT 4
+#define ZU_JMP 5
+#define ZU_PEEP 6
+#define ZU_LINE 7
+#define ZU_INDEX 8
+#define ZU_PAGE 9
+#define ZU_COUNT 10
+
+/* buckets in the root symbol index */
+#define SYM_HASH 4096
+
+/* local labels, 0-9 */
+#define LOC_LABELS 10
+
+/* header info flag, set if extension records follow the symbol table */
+#define H_EXT 0x04
+
+/* extension record types */
+#define EXT_END 0
+#define EXT_ALIGN 1
+#define EXT_LINES 2
+
+#define PCH_MAGIC 0x5054
+#define PCH_VERSION 1
+#define PCH_HEAD_SIZE 8
+
 /* structs */
 
 /* special types */
@@ -41,7 +90,6 @@ struct local {
 	uint8_t type;
 	uint8_t label;
 	uint16_t value;
-	struct local *next;
 };
 
 /* Z80 size = RELOC_SIZE*2 + 2 bytes */
@@ -52,10 +100,58 @@ struct reloc {
 
 /* Z80 size = 4 bytes */
 struct global {
-	struct symbol *symbol;
+	int rec; // record number of the symbol in the root table
+	char name[SYMBOL_NAME_SIZE]; // stays put when the symbol is paged out
 	struct global *next;
 };
 
+/* where a root symbol is in the table, chained by name */
+struct sindex {
+	uint32_t hash;
+	int next; // next record with the same bucket, -1 if none
+};
+
+/* every local with one label, by record number in table order */
+struct lindex {
+	int *rec;
+	int n;
+	int size;
+};
+
+/* allocation chunk, data follows directly after */
+struct chunk {
+	struct chunk *next;
+	int size;
+	int used;
+};
+
+/* a block of tokens being repeated */
+struct rept {
+	struct token *tok;
+	int size;
+	int n; // number of tokens in block
+	int pos; // next token to play back
+	uint16_t iter;
+	uint16_t count;
+	int sym; // record number of the counter symbol, -1 if none
+	struct token end; // the .endr
+	long z80; // Z80 memory the recorded tokens take up
+};
+
+/* most Z80 memory used while a source was read, and how it was split */
+struct zmark {
+	long used;
+	long part[ZU_COUNT]; // bytes held by each table
+	long model; // what the -v estimate came to at the same point
+};
+
+/* start of a run of text bytes from one source line */
+struct lrow {
+	uint16_t addr;
+	uint16_t file;
+	int line;
+};
+
 /* headers for reloc tables */
 struct header {
 	uint16_t last;
@@ -65,8 +161,20 @@ struct header {
 };
 
 
+/* options, set up before assembly */
+extern char *pch_in;
+extern char pch_out;
+extern char asm_opt;
+extern char asm_stack;
+extern char asm_lines;
+extern long z80_budget;
+
+/* if set, errors will jump here instead of exiting */
+extern jmp_buf *asm_recover;
+
 /* interface functions */
 
+void asm_error(char *msg);
 void asm_reset();
 void asm_assemble(char flagg, char flagv);
 
@@ -0,0 +1,615 @@
+/*
+ * cfg.c
+ *
+ * cycle budgets, works out the best and worst case T-states between two labels
+ * by following every path through the encoded instructions
+ */
+#include "cfg.h"
+#include "sio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+/* instructions, in address order */
+struct cnode *cfg_node;
+int cfg_nnode;
+int cfg_snode;
+
+/* loops closed by bounded branches */
+struct cloop *cfg_lp;
+int cfg_nloop;
+uint16_t *cfg_cnt;
+
+/* budgets to check */
+struct cassert *cfg_as;
+int cfg_nas;
+int cfg_sas;
+
+/* bound for the next instruction, -1 if none */
+long cfg_pend;
+
+/* path costs worked out so far */
+struct cstate *cfg_memo[CFG_HASH];
+
+/* instructions being walked, the last one is the one being worked on */
+struct cframe *cfg_fr;
+int cfg_nfr;
+int cfg_sfr;
+
+/* budget being checked */
+struct cassert *cfg_cur;
+jmp_buf cfg_fail;
+
+/*
+ * grows a table so another entry fits
+ *
+ * tab = table to grow
+ * n = entries used
+ * size = entries allocated
+ * each = size of an entry
+ */
+void cfg_grow(void **tab, int n, int *size, int each)
+{
+	if (n < *size)
+		return;
+
+	*size = *size ? *size * 2 : 256;
+	if (!(*tab = realloc(*tab, (size_t) *size * each))) {
+		printf("out of memory\n");
+		exit(1);
+	}
+}
+
+/*
+ * throws away all path costs worked out so far
+ */
+void cfg_forget()
+{
+	struct cstate *s, *next;
+	int i;
+
+	for (i = 0; i < CFG_HASH; i++) {
+		for (s = cfg_memo[i]; s; s = next) {
+			next = s->next;
+			free(s);
+		}
+		cfg_memo[i] = NULL;
+	}
+}
+
+/*
+ * throws away all instructions, budgets, and path costs
+ */
+void cfg_reset()
+{
+	cfg_forget();
+
+	free(cfg_lp);
+	free(cfg_cnt);
+	cfg_lp = NULL;
+	cfg_cnt = NULL;
+
+	cfg_nnode = cfg_nloop = cfg_nas = 0;
+	cfg_pend = -1;
+}
+
+/*
+ * records an instruction emitted into the text segment
+ *
+ * addr = address of instruction
+ * b = instruction bytes
+ * n = number of bytes
+ * hi = T-states if a branch is taken
+ * lo = T-states if a branch is not taken
+ * ext = name of external the instruction refers to, or NULL
+ */
+void cfg_isr(uint16_t addr, uint8_t *b, int n, int hi, int lo, char *ext)
+{
+	struct cnode *c;
+
+	cfg_grow((void **) &cfg_node, cfg_nnode, &cfg_snode, sizeof(struct cnode));
+	c = &cfg_node[cfg_nnode++];
+
+	c->addr = addr;
+	c->n = n;
+	memset(c->b, 0, sizeof(c->b));
+	memcpy(c->b, b, n);
+	c->hi = hi;
+	c->lo = lo;
+	c->bound = cfg_pend;
+	c->loop = -1;
+	c->ext = ext;
+
+	cfg_pend = -1;
+}
+
+/*
+ * bounds the branch of the next instruction
+ *
+ * bound = most times the branch can go back before falling through
+ */
+void cfg_loop(uint16_t bound)
+{
+	cfg_pend = bound;
+}
+
+/*
+ * records a cycle budget
+ *
+ * file = argument index of source
+ * line = line number in source
+ * start = address paths start at
+ * end = address paths end at
+ * max = most T-states allowed
+ */
+void cfg_assert(int file, int line, uint16_t start, uint16_t end, long max)
+{
+	struct cassert *a;
+
+	cfg_grow((void **) &cfg_as, cfg_nas, &cfg_sas, sizeof(struct cassert));
+	a = &cfg_as[cfg_nas++];
+
+	a->file = file;
+	a->line = line;
+	a->start = start;
+	a->end = end;
+	a->max = max;
+}
+
+/*
+ * fails the budget being checked
+ *
+ * msg = what went wrong
+ * addr = address of the instruction at fault
+ */
+void cfg_error(char *msg, uint16_t addr)
+{
+	sio_status(cfg_cur->file, cfg_cur->line);
+	printf(": ");
+	printf(msg, addr);
+	printf("\n");
+	longjmp(cfg_fail, 1);
+}
+
+/*
+ * finds the instruction at an address
+ *
+ * addr = address
+ * returns index of instruction, or -1 if there is none
+ */
+int cfg_find(uint16_t addr)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = cfg_nnode - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (cfg_node[mid].addr == addr)
+			return mid;
+		if (cfg_node[mid].addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return -1;
+}
+
+/*
+ * works out where a branch goes
+ *
+ * c = instruction
+ * target = where to put the address
+ * returns 0 if not a branch, 1 for an absolute branch, 2 for a relative one
+ */
+char cfg_target(struct cnode *c, uint16_t *target)
+{
+	uint8_t op;
+
+	op = c->b[0];
+	if (op == 0xC3 || (op & 0xC7) == 0xC2 || op == 0xCD || (op & 0xC7) == 0xC4) {
+		*target = c->b[1] | (c->b[2] << 8);
+		return 1;
+	}
+
+	if (op == 0x10 || op == 0x18 || (op & 0xE7) == 0x20) {
+		*target = c->addr + 2 + (int8_t) c->b[1];
+		return 2;
+	}
+
+	return 0;
+}
+
+/*
+ * finds the path cost for an instruction with the current loop counts
+ * a new cost is created if there is none yet
+ *
+ * end = address paths end at, -1 if only returns end them
+ * i = index of instruction
+ */
+struct cstate *cfg_state(int end, int i)
+{
+	struct cstate *s;
+	uint16_t cnt[CFG_NEST];
+	uint16_t addr;
+	unsigned int h;
+	int k, n;
+
+	// only the loops around the instruction can have counts
+	addr = cfg_node[i].addr;
+	h = end * 31 + i;
+	n = 0;
+	for (k = 0; k < cfg_nloop; k++) {
+		if (addr < cfg_lp[k].top || addr > cfg_lp[k].bottom)
+			continue;
+
+		if (n == CFG_NEST)
+			cfg_error("loops nested too deep at %04X", addr);
+		cnt[n++] = cfg_cnt[k];
+		h = h * 31 + cfg_cnt[k];
+	}
+	h %= CFG_HASH;
+
+	for (s = cfg_memo[h]; s; s = s->next) {
+		if (s->end == end && s->i == i && s->n == n && !memcmp(s->cnt, cnt, n * sizeof(uint16_t)))
+			return s;
+	}
+
+	if (!(s = malloc(sizeof(struct cstate)))) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	s->end = end;
+	s->i = i;
+	s->n = n;
+	memcpy(s->cnt, cnt, n * sizeof(uint16_t));
+	s->busy = 0;
+	s->done = 0;
+	s->next = cfg_memo[h];
+	cfg_memo[h] = s;
+
+	return s;
+}
+
+/*
+ * adds a path to the best and worst cases
+ *
+ * best = best case so far
+ * worst = worst case so far, -1 if no paths yet
+ * pb = best case of path
+ * pw = worst case of path, -1 if no path
+ * t = T-states to add to the path
+ */
+void cfg_add(long *best, long *worst, long pb, long pw, long t)
+{
+	if (pw < 0)
+		return;
+
+	if (*worst < 0 || pb + t < *best)
+		*best = pb + t;
+	if (pw + t > *worst)
+		*worst = pw + t;
+}
+
+/*
+ * adds a path out of an instruction being walked
+ *
+ * f = instruction
+ * call = set if the path is into the routine of a call
+ * ret = set if the path is after a call, and the cost of the call is added
+ * addr = address the path goes to
+ * t = T-states to add to the path
+ */
+void cfg_edge(struct cframe *f, char call, char ret, uint16_t addr, uint8_t t)
+{
+	struct cedge *e;
+
+	e = &f->e[f->ne++];
+	e->call = call;
+	e->ret = ret;
+	e->addr = addr;
+	e->t = t;
+	e->more = 0;
+}
+
+/*
+ * starts walking an instruction, unless its cost is already known
+ *
+ * end = address paths end at, -1 if only returns end them
+ * i = index of instruction
+ * best = where to put the best case, if it is known
+ * worst = where to put the worst case, -1 if there are no paths
+ * returns 1 if the instruction has to be walked
+ */
+char cfg_enter(int end, int i, long *best, long *worst)
+{
+	struct cstate *s;
+	struct cframe *f;
+	struct cnode *c;
+	uint16_t target;
+	uint8_t op;
+	char kind, cond;
+
+	s = cfg_state(end, i);
+	if (s->busy)
+		cfg_error("path at %04X never ends", cfg_node[i].addr);
+	if (s->done) {
+		*best = s->best;
+		*worst = s->worst;
+		return 0;
+	}
+	s->busy = 1;
+
+	cfg_grow((void **) &cfg_fr, cfg_nfr, &cfg_sfr, sizeof(struct cframe));
+	f = &cfg_fr[cfg_nfr++];
+	f->s = s;
+	f->end = end;
+	f->i = i;
+	f->best = 0;
+	f->worst = -1;
+	f->ne = 0;
+	f->step = 0;
+	f->nsave = 0;
+
+	c = &cfg_node[i];
+	op = c->b[0];
+
+	// indirect jumps and restarts cannot be followed
+	if (op == 0xE9 || ((op == 0xDD || op == 0xFD) && c->b[1] == 0xE9))
+		cfg_error("indirect jump at %04X", c->addr);
+	if ((op & 0xC7) == 0xC7)
+		cfg_error("cannot follow rst at %04X", c->addr);
+
+	kind = cfg_target(c, &target);
+	cond = c->hi != c->lo || (op & 0xC7) == 0xC2;
+
+	if (op == 0xC9 || (op == 0xED && (c->b[1] == 0x4D || c->b[1] == 0x45))) {
+		// return, the path is done
+		cfg_add(&f->best, &f->worst, 0, 0, c->hi);
+	} else if ((op & 0xC7) == 0xC0) {
+		// conditional return
+		cfg_add(&f->best, &f->worst, 0, 0, c->hi);
+		cfg_edge(f, 0, 0, c->addr + c->n, c->lo);
+	} else if (op == 0xCD || (op & 0xC7) == 0xC4) {
+		// call, the routine returns to the next instruction
+		cfg_edge(f, 1, 0, target, 0);
+		cfg_edge(f, 0, 1, c->addr + c->n, c->hi);
+		if (cond)
+			cfg_edge(f, 0, 0, c->addr + c->n, c->lo);
+	} else if (op == 0xED && (c->b[1] & 0xF4) == 0xB0) {
+		// block repeat, goes around itself until it is done, at most its bound times
+		if (c->bound < 1)
+			cfg_error("block repeat at %04X needs a .loop bound", c->addr);
+		cfg_edge(f, 0, 0, c->addr + c->n, c->lo);
+		f->e[0].more = c->hi * (c->bound - 1);
+	} else if (kind) {
+		// jump
+		cfg_edge(f, 0, 0, target, c->hi);
+		if (cond)
+			cfg_edge(f, 0, 0, c->addr + c->n, c->lo);
+	} else {
+		cfg_edge(f, 0, 0, c->addr + c->n, c->hi);
+	}
+
+	return 1;
+}
+
+/*
+ * starts following a path out of an instruction being walked
+ * loop counts are changed for the path, and put back once it is done
+ *
+ * f = instruction
+ * best = where to put the best case, if it is known
+ * worst = where to put the worst case, -1 if there are no paths
+ * returns 1 if another instruction has to be walked first
+ */
+char cfg_go(struct cframe *f, long *best, long *worst)
+{
+	struct cnode *from;
+	struct cedge *e;
+	int i, k;
+
+	from = &cfg_node[f->i];
+	e = &f->e[f->step];
+	f->nsave = 0;
+	*best = 0;
+	*worst = -1;
+
+	if (e->call) {
+		// the routine has loop counts of its own
+		if ((i = cfg_find(e->addr)) < 0)
+			cfg_error("call at %04X leaves the code", from->addr);
+
+		for (k = 0; k < cfg_nloop && f->nsave < CFG_NEST; k++) {
+			if (!cfg_cnt[k])
+				continue;
+			f->saved[f->nsave] = k;
+			f->save[f->nsave++] = cfg_cnt[k];
+			cfg_cnt[k] = 0;
+		}
+
+		if (cfg_state(-1, i)->busy)
+			cfg_error("recursive call at %04X", from->addr);
+		return cfg_enter(-1, i, best, worst);
+	}
+
+	if (e->addr == f->end) {
+		*worst = 0;
+		return 0;
+	}
+
+	if ((i = cfg_find(e->addr)) < 0)
+		cfg_error("path leaves the code at %04X", from->addr);
+
+	// going back around a loop
+	if (e->addr <= from->addr) {
+		if ((k = from->loop) < 0)
+			cfg_error("backwards branch at %04X needs a .loop bound", from->addr);
+		if (cfg_cnt[k] >= cfg_lp[k].bound)
+			return 0;
+
+		f->saved[f->nsave] = k;
+		f->save[f->nsave++] = cfg_cnt[k]++;
+	}
+
+	// leaving a loop starts its count over
+	for (k = 0; k < cfg_nloop; k++) {
+		if (!cfg_cnt[k] || (e->addr >= cfg_lp[k].top && e->addr <= cfg_lp[k].bottom))
+			continue;
+
+		if (f->nsave == CFG_NEST + 1)
+			cfg_error("loops nested too deep at %04X", e->addr);
+		f->saved[f->nsave] = k;
+		f->save[f->nsave++] = cfg_cnt[k];
+		cfg_cnt[k] = 0;
+	}
+
+	return cfg_enter(f->end, i, best, worst);
+}
+
+/*
+ * adds a path that was followed to the instruction it came out of
+ *
+ * f = instruction
+ * pb = best case of path
+ * pw = worst case of path, -1 if no path
+ */
+void cfg_done(struct cframe *f, long pb, long pw)
+{
+	struct cedge *e;
+
+	while (f->nsave--)
+		cfg_cnt[f->saved[f->nsave]] = f->save[f->nsave];
+
+	e = &f->e[f->step++];
+	if (e->call) {
+		// a routine that never returns has nothing after it
+		f->cb = pb;
+		f->cw = pw;
+		if (pw < 0)
+			f->step++;
+	} else if (e->ret) {
+		if (pw >= 0)
+			cfg_add(&f->best, &f->worst, pb + f->cb, pw + f->cw, e->t);
+	} else {
+		cfg_add(&f->best, &f->worst, pb, pw < 0 ? pw : pw + e->more, e->t);
+	}
+}
+
+/*
+ * works out the best and worst case T-states from an instruction to the end
+ * the walk keeps its own stack, so long loops do not run out of host stack
+ *
+ * end = address paths end at, -1 if only returns end them
+ * i = index of instruction
+ * best = where to put the best case
+ * worst = where to put the worst case, -1 if there are no paths
+ */
+void cfg_walk(int end, int i, long *best, long *worst)
+{
+	struct cframe *f;
+	long pb, pw;
+
+	if (!cfg_enter(end, i, best, worst))
+		return;
+
+	while (cfg_nfr) {
+		f = &cfg_fr[cfg_nfr - 1];
+
+		if (f->step < f->ne) {
+			// follow the next path, the instruction it reaches may need walking first
+			if (!cfg_go(f, &pb, &pw))
+				cfg_done(f, pb, pw);
+			continue;
+		}
+
+		// every path has been followed
+		f->s->busy = 0;
+		f->s->done = 1;
+		f->s->best = pb = f->best;
+		f->s->worst = pw = f->worst;
+
+		if (--cfg_nfr)
+			cfg_done(&cfg_fr[cfg_nfr - 1], pb, pw);
+	}
+
+	*best = pb;
+	*worst = pw;
+}
+
+/*
+ * finds the loops closed by bounded backwards branches
+ */
+void cfg_loops()
+{
+	struct cnode *c;
+	uint16_t target;
+	int i;
+
+	cfg_lp = malloc(sizeof(struct cloop) * (cfg_nnode + 1));
+	cfg_cnt = calloc(cfg_nnode + 1, sizeof(uint16_t));
+	if (!cfg_lp || !cfg_cnt) {
+		printf("out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < cfg_nnode; i++) {
+		c = &cfg_node[i];
+		if (c->bound < 0 || !cfg_target(c, &target) || target > c->addr)
+			continue;
+
+		c->loop = cfg_nloop;
+		cfg_lp[cfg_nloop].top = target;
+		cfg_lp[cfg_nloop].bottom = c->addr;
+		cfg_lp[cfg_nloop++].bound = c->bound;
+	}
+}
+
+/*
+ * checks all cycle budgets
+ *
+ * flagv = print out the best and worst cases
+ * returns number of budgets that failed
+ */
+int cfg_check(char flagv)
+{
+	long best, worst;
+	int i, j, fail;
+
+	fail = 0;
+	if (cfg_nas)
+		cfg_loops();
+
+	for (i = 0; i < cfg_nas; i++) {
+		cfg_cur = &cfg_as[i];
+		if (setjmp(cfg_fail)) {
+			// loop counts and costs are left wherever the error was
+			memset(cfg_cnt, 0, sizeof(uint16_t) * (cfg_nnode + 1));
+			cfg_forget();
+			cfg_nfr = 0;
+			fail++;
+			continue;
+		}
+
+		if ((j = cfg_find(cfg_cur->start)) < 0)
+			cfg_error("no instruction at %04X", cfg_cur->start);
+		cfg_walk(cfg_cur->end, j, &best, &worst);
+
+		if (worst < 0)
+			cfg_error("no path reaches %04X", cfg_cur->end);
+
+		if (flagv)
+			printf("cycles %04X to %04X: best %ld, worst %ld, budget %ld\n", cfg_cur->start, cfg_cur->end, best, worst, cfg_cur->max);
+
+		if (worst > cfg_cur->max) {
+			sio_status(cfg_cur->file, cfg_cur->line);
+			printf(": worst case is %ld T-states, over budget of %ld\n", worst, cfg_cur->max);
+			fail++;
+		}
+	}
+
+	return fail;
+}
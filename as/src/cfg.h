@@ -0,0 +1,110 @@
+#ifndef CFG_H
+#define CFG_H
+
+/* includes */
+#include <stdint.h>
+
+/* defines */
+
+/* most bounded loops that can be around one instruction */
+#define CFG_NEST 8
+
+/* buckets in the path cost table */
+#define CFG_HASH 4096
+
+/* structs */
+
+/*
+ * an instruction in the text segment
+ */
+struct cnode {
+	uint16_t addr;
+	uint8_t n;
+	uint8_t b[4];
+	uint8_t hi; // T-states if a branch is taken
+	uint8_t lo; // T-states if a branch is not taken
+	long bound; // times the branch may go back, -1 if not bounded
+	int loop; // loop the branch closes, -1 if none
+	char *ext; // external the instruction refers to, or NULL
+};
+
+/*
+ * a loop, from the target of a backwards branch to the branch
+ */
+struct cloop {
+	uint16_t top;
+	uint16_t bottom;
+	long bound;
+};
+
+/*
+ * a cycle budget to check
+ */
+struct cassert {
+	int file;
+	int line;
+	uint16_t start;
+	uint16_t end;
+	long max;
+};
+
+/*
+ * cost of the paths from an instruction, with the loops around it counted so far
+ */
+struct cstate {
+	int end;
+	int i;
+	uint8_t n;
+	uint16_t cnt[CFG_NEST];
+	char busy;
+	char done;
+	long best;
+	long worst;
+	struct cstate *next;
+};
+
+/*
+ * a path out of an instruction, to the next one or a branch target, or into a call
+ */
+struct cedge {
+	char call; // set if this is the routine of a call
+	char ret; // set if the cost of the call before it is added
+	uint16_t addr;
+	uint8_t t; // T-states to add to the path
+	long more; // T-states the worst case takes on top of t
+};
+
+/*
+ * an instruction being walked, with the paths out of it still to follow
+ */
+struct cframe {
+	struct cstate *s;
+	int end;
+	int i;
+	long best;
+	long worst;
+	long cb; // cost of the call made by the instruction
+	long cw;
+	struct cedge e[3];
+	int ne;
+	int step; // path being followed
+	uint16_t save[CFG_NEST + 1]; // loop counts to put back once the path is done
+	int saved[CFG_NEST + 1];
+	int nsave;
+};
+
+/* instructions, in address order */
+extern struct cnode *cfg_node;
+extern int cfg_nnode;
+
+/* interface functions */
+
+void cfg_reset();
+void cfg_isr(uint16_t addr, uint8_t *b, int n, int hi, int lo, char *ext);
+void cfg_loop(uint16_t bound);
+void cfg_assert(int file, int line, uint16_t start, uint16_t end, long max);
+int cfg_check(char flagv);
+int cfg_find(uint16_t addr);
+char cfg_target(struct cnode *c, uint16_t *target);
+
+#endif
@@ -3,6 +3,7 @@
 
 /* includes */
 #include <stdint.h>
+#include <stddef.h>
 
 /* defines */
 #define END 0
@@ -22,6 +23,15 @@
 #define EXCH 14 // exchange instruction
 #define INTMODE 15 // interrupt mode instruction
 #define LOAD 16 // load instruction
+#define RELAX 17 // jr or jp, whichever fits
+
+/* peephole rules */
+#define PEEP_XOR 0
+#define PEEP_OR 1
+#define PEEP_TAIL 2
+#define PEEP_ADD 3
+#define PEEP_NEXT 4
+#define PEEP_RULES 5
 
 #define UNARY 0
 #define CARRY 1
@@ -35,11 +45,25 @@ struct instruct {
 	uint8_t arg;
 };
 
+struct peep {
+	char *rule;
+	char *differs;
+};
+
 struct oprnd {
 	uint8_t type;
 	char *mnem;
 };
 
+/* peephole rules, and how the replacement behaves differently (if at all) */
+struct peep peep_table[] = {
+	{ "ld a,0 -> xor a", "sets all flags, ld leaves them alone" },
+	{ "cp 0 -> or a", "P/V is parity instead of overflow, N is reset" },
+	{ "call x / ret -> jp x", "x sees one less return address on the stack" },
+	{ "sla l / rl h -> add hl,hl", "S, Z and P/V are left alone, H is from bit 11" },
+	{ "jp to next line -> removed", NULL },
+};
+
 /* (simple) operand table */
 struct oprnd op_table[] = {
 	{ 0, "b" },
@@ -116,6 +140,29 @@ struct oprnd op_table[] = {
  * next is \n = 255
  */
 
+/*
+ * T-states for each unprefixed opcode, conditional branches are counted as taken
+ * prefixed opcodes are worked out by asm_cycles()
+ */
+uint8_t cyc_table[256] = {
+	4, 10, 7, 6, 4, 4, 7, 4, 4, 11, 7, 6, 4, 4, 7, 4,
+	13, 10, 7, 6, 4, 4, 7, 4, 12, 11, 7, 6, 4, 4, 7, 4,
+	12, 10, 16, 6, 4, 4, 7, 4, 12, 11, 16, 6, 4, 4, 7, 4,
+	12, 10, 13, 6, 11, 11, 10, 4, 12, 11, 13, 6, 4, 4, 7, 4,
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	7, 7, 7, 7, 7, 7, 4, 7, 4, 4, 4, 4, 4, 4, 7, 4,
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	11, 10, 10, 10, 17, 11, 7, 11, 11, 10, 10, 0, 17, 17, 7, 11,
+	11, 10, 10, 11, 17, 11, 7, 11, 11, 4, 10, 11, 17, 0, 7, 11,
+	11, 10, 10, 19, 17, 11, 7, 11, 11, 4, 10, 4, 17, 0, 7, 11,
+	11, 10, 10, 4, 17, 11, 7, 11, 11, 6, 10, 4, 17, 0, 7, 11
+};
+
 /* instruction table */
 struct instruct isr_table[] = {
 	// basic instructions
@@ -218,6 +265,9 @@ struct instruct isr_table[] = {
 	// load instructions
 	{ LOAD, "ld", 0x00, 0x00 },
 	
+	// relaxed jump
+	{ RELAX, "jmp", 0xC2, 0x20 },
+	
 	{ END, "", 0x00, 0x00}
 };
 
@@ -0,0 +1,689 @@
+/*
+ * lex.c
+ *
+ * tokenizer, turns source characters into tokens for the assembler
+ * tokens are passed through a ring, so the lexer can run on its own thread
+ * sources can also be lexed all at once into their own buffers, on worker threads
+ */
+#include "lex.h"
+#include "sio.h"
+#include "stat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* run the lexer on its own thread */
+char lex_piped;
+
+/* lex each source on its own, on worker threads */
+char lex_split;
+
+/* keep token buffers between runs, for sources that have not changed */
+char lex_keep;
+
+/* token ring, written by the lexer and read by the assembler */
+struct token *lex_ring;
+unsigned int lex_mask;
+atomic_uint lex_head;
+atomic_uint lex_tail;
+
+/* lexer thread */
+pthread_t lex_thread;
+char lex_running;
+atomic_int lex_stop;
+
+/* lexer reading through sio */
+struct lexer lex_sio;
+
+/* token buffers for each source, by argument index */
+struct tbuf *lex_bufs;
+int lex_nbufs;
+atomic_int lex_nextf;
+atomic_long lex_lexed;
+
+/* where the assembler is reading in the token buffers */
+int lex_cur;
+int lex_pos;
+
+/* worker threads */
+pthread_t *lex_workers;
+int lex_nwork;
+
+/*
+ * returns the next character without moving forward
+ *
+ * lx = lexer
+ */
+char lex_peekc(struct lexer *lx)
+{
+	if (!lx->buf)
+		return sio_peek();
+	
+	return lx->bufi < lx->bufc ? lx->buf[lx->bufi] : -1;
+}
+
+/*
+ * returns the next character, or -1 if complete
+ *
+ * lx = lexer
+ */
+char lex_nextc(struct lexer *lx)
+{
+	char out;
+	
+	if (!lx->buf)
+		return sio_next();
+	
+	if (lx->bufi >= lx->bufc)
+		return -1;
+	
+	out = lx->buf[lx->bufi++];
+	if (out == '\n') lx->line++;
+	
+	return out;
+}
+
+/*
+ * remembers where a string or character starts
+ *
+ * lx = lexer
+ */
+void lex_mark(struct lexer *lx)
+{
+	if (lx->buf) {
+		lx->sfile = lx->file;
+		lx->sline = lx->line;
+	} else {
+		sio_pos(&lx->sfile, &lx->sline);
+	}
+}
+
+/*
+ * checks if the source a string or character started in is done
+ * sio runs straight on into the next source, so the source is checked too
+ *
+ * lx = lexer
+ * returns true (1) or false (0)
+ */
+char lex_endc(struct lexer *lx)
+{
+	int file, line;
+	
+	if (lx->buf)
+		return lx->bufi >= lx->bufc;
+	
+	sio_pos(&file, &line);
+	return sio_peek() == -1 || file != lx->sfile;
+}
+
+/*
+ * skips past all of the white space to a token
+ *
+ * lx = lexer
+ */
+void lex_wskip(struct lexer *lx)
+{
+	char c, comment;
+
+	comment = 0;
+	while (((c = lex_peekc(lx)) <= ' ' || c == ';' || comment) && c != '\n' && c != -1)
+		if (lex_nextc(lx) == ';') comment = 1;
+}
+
+/*
+ * tests if a character is a alpha (aA - zZ or underscore)
+ *
+ * in = character to test
+ * returns true (1) or false (0)
+ */
+char lex_alpha(char in)
+{
+	return (in >= 'A' && in <= 'Z') || (in >= 'a' && in <= 'z') || in == '_';
+}
+
+/*
+ * tests if a character is a number
+ *
+ * in = character to test
+ * returns true (1) or false (0)
+ */
+char lex_num(char in)
+{
+	return (in >= '0' && in <= '9');
+}
+
+/*
+ * checks if a token is the af register, the only place a bare ' shows up
+ *
+ * t = token to check
+ * returns true (1) or false (0)
+ */
+char lex_isaf(struct token *t)
+{
+	return t->type == 'a' && t->len == 2 && (t->text[0] | 0x20) == 'a' && (t->text[1] | 0x20) == 'f';
+}
+
+/*
+ * reads raw string characters into a token until it is full or the string ends
+ * the closing " is consumed but not stored
+ *
+ * lx = lexer
+ * t = token to fill
+ */
+void lex_string(struct lexer *lx, struct token *t)
+{
+	char c;
+
+	while (t->len < TOKEN_TEXT_SIZE) {
+		// a string never runs on into the next source
+		if (lex_endc(lx)) {
+			lx->instr = 0;
+			return;
+		}
+
+		c = lex_nextc(lx);
+
+		if (c == '"' && !lx->esc) {
+			lx->instr = 0;
+			t->flags |= LEX_CLOSED;
+			return;
+		}
+
+		lx->esc = !lx->esc && c == '\\';
+		t->text[t->len++] = c;
+	}
+}
+
+/*
+ * reads the next token in from the source
+ * white space will by cycled past, both in front and behind the token
+ * strings and character literals are read raw, escapes are left to the assembler
+ *
+ * lx = lexer
+ * t = token to fill
+ */
+void lex_token(struct lexer *lx, struct token *t)
+{
+	char c;
+	int file, line;
+
+	t->len = 0;
+	t->flags = 0;
+	lx->count++;
+
+	if (lx->instr) {
+		// rest of a long string
+		t->type = LEX_MORE;
+		lex_string(lx, t);
+	} else {
+		// skip all leading white space
+		lex_wskip(lx);
+
+		c = lex_peekc(lx);
+		if (lex_alpha(c) || lex_num(c)) {
+			t->type = lex_alpha(c) ? 'a' : '0';
+
+			while (lex_num(c) || lex_alpha(c)) {
+				if (t->len < TOKEN_BUF_SIZE - 1)
+					t->text[t->len++] = c;
+
+				lex_nextc(lx);
+				c = lex_peekc(lx);
+			}
+			t->text[t->len] = 0;
+		} else if (c == '"') {
+			t->type = '"';
+			lex_mark(lx);
+			lex_nextc(lx);
+			lx->instr = 1;
+			lx->esc = 0;
+			lex_string(lx, t);
+		} else if (c == '\'' && !lx->af) {
+			// character literal, the closing ' is optional here
+			t->type = '\'';
+			lex_mark(lx);
+			lex_nextc(lx);
+			t->text[t->len++] = c = lex_endc(lx) ? -1 : lex_nextc(lx);
+			if (c == '\\')
+				t->text[t->len++] = lex_endc(lx) ? -1 : lex_nextc(lx);
+
+			lex_wskip(lx);
+			if (!lex_endc(lx) && lex_peekc(lx) == '\'') {
+				lex_nextc(lx);
+				t->flags |= LEX_CLOSED;
+			}
+		} else {
+			t->type = lex_nextc(lx);
+
+			// correct for new lines
+			if (t->type == '\n') t->type = 'n';
+		}
+
+		lx->af = lex_isaf(t);
+	}
+
+	// skip more whitespace
+	if (!lx->instr)
+		lex_wskip(lx);
+
+	if (lx->buf) {
+		t->file = lx->file;
+		t->line = lx->line;
+	} else {
+		sio_pos(&file, &line);
+		t->file = file;
+		t->line = line;
+	}
+
+	// a string cut off by the end of its source is placed where it started
+	if ((t->type == '"' || t->type == LEX_MORE || t->type == '\'') && !(t->flags & LEX_CLOSED) && !lx->instr) {
+		t->file = lx->sfile;
+		t->line = lx->sline;
+	}
+}
+
+/*
+ * puts a token into the ring, waiting for room if needed
+ *
+ * t = token to put
+ */
+void lex_put(struct token *t)
+{
+	unsigned int head;
+
+	head = atomic_load_explicit(&lex_head, memory_order_relaxed);
+	while (head - atomic_load_explicit(&lex_tail, memory_order_acquire) > lex_mask) {
+		if (atomic_load_explicit(&lex_stop, memory_order_relaxed))
+			return;
+		sched_yield();
+	}
+
+	lex_ring[head & lex_mask] = *t;
+	atomic_store_explicit(&lex_head, head + 1, memory_order_release);
+}
+
+/*
+ * lexer thread, runs until the end of the input
+ *
+ * arg = unused
+ */
+void *lex_main(void *arg)
+{
+	struct token t;
+
+	do {
+		lex_token(&lex_sio, &t);
+		lex_put(&t);
+	} while (t.type != -1 && !atomic_load_explicit(&lex_stop, memory_order_relaxed));
+
+	return NULL;
+}
+
+/*
+ * adds a token to the end of a token buffer, growing it if needed
+ *
+ * b = token buffer
+ * returns the new token
+ */
+struct token *lex_bnew(struct tbuf *b)
+{
+	if (b->used == b->size) {
+		b->size = b->size ? b->size * 2 : LEX_BUF_SIZE;
+		if (!(b->tok = (struct token *) realloc(b->tok, sizeof(struct token) * b->size))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+	}
+
+	return &b->tok[b->used++];
+}
+
+/*
+ * lexes a whole source into its token buffer
+ * the buffer always ends with an end of input token
+ *
+ * i = argument index of source
+ */
+void lex_source(int i)
+{
+	struct lexer lx;
+	struct tbuf *b;
+	struct token *t;
+
+	lx.buf = sio_source(i, &lx.bufc);
+	lx.bufi = 0;
+	lx.file = i;
+	lx.line = 1;
+	lx.count = 0;
+	lx.instr = lx.esc = lx.af = 0;
+
+	// unreadable sources are empty
+	if (!lx.buf)
+		lx.buf = "";
+
+	b = &lex_bufs[i];
+	b->used = 0;
+	do {
+		t = lex_bnew(b);
+		lex_token(&lx, t);
+	} while (t->type != -1 && !atomic_load_explicit(&lex_stop, memory_order_relaxed));
+
+	// stopped early, make sure the buffer is still terminated, it cannot be kept
+	b->keep = lex_keep;
+	if (t->type != -1) {
+		t->type = -1;
+		b->keep = 0;
+	}
+
+	atomic_fetch_add(&lex_lexed, b->used);
+	atomic_store_explicit(&b->done, 1, memory_order_release);
+}
+
+/*
+ * worker thread, lexes sources in argument order until there are none left
+ *
+ * arg = unused
+ */
+void *lex_work(void *arg)
+{
+	int i;
+
+	while ((i = atomic_fetch_add(&lex_nextf, 1)) < lex_nbufs)
+		if (!atomic_load_explicit(&lex_bufs[i].done, memory_order_acquire))
+			lex_source(i);
+
+	return NULL;
+}
+
+/*
+ * starts lexing every source into its own buffer
+ */
+void lex_fork()
+{
+	int i, n;
+
+	n = sio_count();
+	sio_hold(n);
+
+	if (n > lex_nbufs) {
+		if (!(lex_bufs = (struct tbuf *) realloc(lex_bufs, sizeof(struct tbuf) * n))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+
+		for (i = lex_nbufs; i < n; i++) {
+			lex_bufs[i].tok = NULL;
+			lex_bufs[i].size = 0;
+			lex_bufs[i].keep = 0;
+		}
+	}
+	lex_nbufs = n;
+
+	// buffers kept from the last run are already done
+	for (i = 0; i < n; i++) {
+		if (lex_bufs[i].keep)
+			continue;
+		lex_bufs[i].used = 0;
+		atomic_store(&lex_bufs[i].done, 0);
+	}
+	atomic_store(&lex_nextf, 1);
+
+	// one worker per core, but no more than there are sources
+	lex_nwork = sysconf(_SC_NPROCESSORS_ONLN);
+	if (lex_nwork > n - 1)
+		lex_nwork = n - 1;
+	if (lex_nwork < 1)
+		lex_nwork = 1;
+
+	if (!(lex_workers = (pthread_t *) realloc(lex_workers, sizeof(pthread_t) * lex_nwork))) {
+		printf("out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < lex_nwork; i++) {
+		if (pthread_create(&lex_workers[i], NULL, lex_work, NULL)) {
+			printf("cannot start lexer thread\n");
+			exit(1);
+		}
+	}
+}
+
+/*
+ * starts lexing from the current input position
+ *
+ * start = token to set to the starting position
+ */
+void lex_start(struct token *start)
+{
+	int file, line;
+
+	atomic_store(&lex_head, 0);
+	atomic_store(&lex_tail, 0);
+	atomic_store(&lex_stop, 0);
+	lex_sio.buf = NULL;
+	lex_sio.instr = 0;
+	lex_sio.af = 0;
+	lex_cur = 1;
+	lex_pos = 0;
+
+	sio_pos(&file, &line);
+	start->type = 'n';
+	start->len = 0;
+	start->file = file;
+	start->line = line;
+
+	if (lex_piped && !lex_split) {
+		if (pthread_create(&lex_thread, NULL, lex_main, NULL)) {
+			printf("cannot start lexer thread\n");
+			exit(1);
+		}
+		lex_running = 1;
+	}
+}
+
+/*
+ * gets the lexer ready for the start of the input
+ * the input must already be opened
+ *
+ * start = token to set to the starting position
+ */
+void lex_open(struct token *start)
+{
+	int size;
+
+	size = lex_piped ? LEX_RING_SIZE : LEX_RING_MIN;
+	if (lex_mask != size - 1) {
+		free(lex_ring);
+		if (!(lex_ring = (struct token *) malloc(sizeof(struct token) * size))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+		lex_mask = size - 1;
+	}
+
+	lex_start(start);
+
+	// sources are only lexed once, both passes read the same buffers
+	if (lex_split)
+		lex_fork();
+}
+
+/*
+ * stops any lexer threads that are running
+ */
+void lex_close()
+{
+	int i;
+
+	if (lex_running) {
+		atomic_store(&lex_stop, 1);
+		pthread_join(lex_thread, NULL);
+		lex_running = 0;
+	}
+
+	if (lex_nwork) {
+		atomic_store(&lex_stop, 1);
+		for (i = 0; i < lex_nwork; i++)
+			pthread_join(lex_workers[i], NULL);
+		lex_nwork = 0;
+
+		stat_tokens += atomic_exchange(&lex_lexed, 0);
+	}
+
+	stat_tokens += lex_sio.count;
+	lex_sio.count = 0;
+}
+
+/*
+ * throws away the tokens kept for a source, because it has changed
+ *
+ * i = argument index of source
+ */
+void lex_drop(int i)
+{
+	if (i < lex_nbufs)
+		lex_bufs[i].keep = 0;
+}
+
+/*
+ * brings the lexer back to the beginning of source
+ *
+ * start = token to set to the starting position
+ */
+void lex_rewind(struct token *start)
+{
+	if (lex_split) {
+		// already lexed, just read the buffers again
+		lex_start(start);
+		return;
+	}
+
+	lex_close();
+	sio_rewind();
+	lex_start(start);
+}
+
+/*
+ * returns the next token out of the token buffers
+ * waits for the current source to be lexed if needed
+ */
+struct token *lex_bpeek()
+{
+	struct tbuf *b;
+	struct token *t;
+
+	while (1) {
+		b = &lex_bufs[lex_cur];
+		while (!atomic_load_explicit(&b->done, memory_order_acquire))
+			sched_yield();
+
+		t = &b->tok[lex_pos];
+
+		// end of this source, carry on into the next
+		if (t->type == -1 && lex_cur + 1 < lex_nbufs) {
+			lex_cur++;
+			lex_pos = 0;
+			continue;
+		}
+
+		return t;
+	}
+}
+
+/*
+ * looks ahead into the token buffers, without moving through them
+ *
+ * n = number of tokens to skip over
+ */
+struct token *lex_bahead(int n)
+{
+	struct token *t;
+	int cur, pos;
+
+	lex_bpeek();
+	cur = lex_cur;
+	pos = lex_pos;
+
+	while (1) {
+		while (!atomic_load_explicit(&lex_bufs[cur].done, memory_order_acquire))
+			sched_yield();
+
+		t = &lex_bufs[cur].tok[pos];
+
+		if (t->type == -1 && cur + 1 < lex_nbufs) {
+			cur++;
+			pos = 0;
+			continue;
+		}
+
+		if (!n-- || t->type == -1)
+			return t;
+		pos++;
+	}
+}
+
+/*
+ * returns a token further on without consuming anything
+ * there is only ever enough room in the ring to see LEX_RING_MIN tokens ahead
+ *
+ * n = number of tokens to skip over, less than LEX_RING_MIN
+ */
+struct token *lex_ahead(int n)
+{
+	unsigned int tail, i;
+	struct token *t, tok;
+
+	if (lex_split)
+		return n ? lex_bahead(n) : lex_bpeek();
+
+	tail = atomic_load_explicit(&lex_tail, memory_order_relaxed);
+	for (i = 0; ; i++) {
+		while (atomic_load_explicit(&lex_head, memory_order_acquire) == tail + i) {
+			if (lex_piped) {
+				sched_yield();
+			} else {
+				lex_token(&lex_sio, &tok);
+				lex_put(&tok);
+			}
+		}
+
+		// nothing comes after the end of the input
+		t = &lex_ring[(tail + i) & lex_mask];
+		if (i == n || t->type == -1)
+			return t;
+	}
+}
+
+/*
+ * returns the next token without consuming it
+ * without a lexer thread, the token is lexed on demand
+ */
+struct token *lex_peek()
+{
+	return lex_ahead(0);
+}
+
+/*
+ * consumes the next token
+ * the end of the input is never consumed, so it can be read over and over
+ *
+ * out = where to copy the token
+ */
+void lex_get(struct token *out)
+{
+	struct token *t;
+
+	t = lex_peek();
+	*out = *t;
+
+	if (t->type == -1)
+		return;
+
+	if (lex_split)
+		lex_pos++;
+	else
+		atomic_store_explicit(&lex_tail, atomic_load_explicit(&lex_tail, memory_order_relaxed) + 1, memory_order_release);
+}
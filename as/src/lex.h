@@ -0,0 +1,85 @@
+#ifndef LEX_H
+#define LEX_H
+
+/* includes */
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* defines */
+
+#define TOKEN_BUF_SIZE 19
+#define TOKEN_TEXT_SIZE 23
+
+/* must be a power of 2 */
+#define LEX_RING_SIZE 1024
+#define LEX_RING_MIN 4
+
+/* token type for the rest of a string that did not fit in one token */
+#define LEX_MORE 1
+
+/* token flags */
+#define LEX_CLOSED 1
+
+/* starting size of a per-source token buffer */
+#define LEX_BUF_SIZE 1024
+
+/* structs */
+
+/*
+ * a single token, as the assembler sees it
+ * file and line are where the input was left after reading the token
+ */
+struct token {
+	int line;
+	uint16_t file;
+	char type;
+	uint8_t len;
+	uint8_t flags;
+	char text[TOKEN_TEXT_SIZE];
+};
+
+/*
+ * lexer state
+ * a lexer either reads a source held in memory, or goes through sio if buf is NULL
+ */
+struct lexer {
+	char *buf;
+	int bufi;
+	int bufc;
+	int file;
+	int line;
+	long count;
+	char instr;
+	char esc;
+	int sfile; // where the string being read started
+	int sline;
+	char af;
+};
+
+/*
+ * tokens for a single source, lexed ahead of time
+ */
+struct tbuf {
+	struct token *tok;
+	int size;
+	int used;
+	atomic_int done;
+	char keep; // good for the next run, if the source does not change
+};
+
+/* options */
+extern char lex_piped;
+extern char lex_split;
+extern char lex_keep;
+
+/* interface functions */
+
+void lex_open(struct token *start);
+void lex_rewind(struct token *start);
+void lex_close();
+void lex_drop(int i);
+struct token *lex_peek();
+struct token *lex_ahead(int n);
+void lex_get(struct token *out);
+
+#endif
\ No newline at end of file
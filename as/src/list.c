@@ -0,0 +1,301 @@
+/*
+ * list.c
+ *
+ * listing output, shows what each line of source turned into
+ */
+#include "list.h"
+#include "sio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* listing file */
+FILE *list_file;
+char *list_name;
+
+/* line being built up */
+uint8_t *list_buf;
+int list_size;
+int list_count;
+uint16_t list_addr;
+char list_seg;
+int list_hi;
+int list_lo;
+char list_isr;
+
+/* label totals */
+struct ltotal *list_tot;
+int list_stot;
+int list_ntot;
+struct ltotal *list_cur;
+
+/* source being echoed */
+FILE *list_src;
+int list_sfile;
+int list_sline;
+char *list_text;
+size_t list_tsize;
+
+/*
+ * opens up a listing file
+ *
+ * name = name of listing file
+ */
+void list_open(char *name)
+{
+	if (!(list_file = fopen(name, "w"))) {
+		printf("cannot open %s\n", name);
+		exit(1);
+	}
+	list_name = name;
+
+	fprintf(list_file, "%-8s%-14s%-9s%-10s%s\n", "addr", "bytes", "cycles", "total", "source");
+
+	list_ntot = 0;
+	list_cur = NULL;
+	list_src = NULL;
+	list_sfile = 0;
+	list_clear();
+}
+
+/*
+ * returns if a listing is being written
+ */
+char list_active()
+{
+	return list_file != NULL;
+}
+
+/*
+ * throws away anything collected for the current line
+ */
+void list_clear()
+{
+	list_count = 0;
+	list_seg = 0;
+	list_hi = list_lo = 0;
+	list_isr = 0;
+}
+
+/*
+ * records a byte emitted on the current line
+ * bss bytes are counted, but not shown
+ *
+ * seg = segment of byte
+ * addr = segment relative address
+ * b = byte
+ */
+void list_byte(char seg, uint16_t addr, uint8_t b)
+{
+	if (!list_seg) {
+		list_seg = seg;
+		list_addr = addr;
+	}
+
+	// bss is never shown, so there is no need to keep it
+	if (seg == 3) {
+		list_count++;
+		return;
+	}
+
+	if (list_count == list_size) {
+		list_size = list_size ? list_size * 2 : LIST_BYTES;
+		if (!(list_buf = (uint8_t *) realloc(list_buf, list_size))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+	}
+	list_buf[list_count++] = b;
+}
+
+/*
+ * records the cycles an instruction on the current line takes
+ *
+ * hi = T-states if a branch is taken
+ * lo = T-states if a branch is not taken
+ */
+void list_cycles(int hi, int lo)
+{
+	list_isr = 1;
+	list_hi += hi;
+	list_lo += lo;
+
+	if (list_cur) {
+		list_cur->hi += hi;
+		list_cur->lo += lo;
+	}
+}
+
+/*
+ * starts a new running total at a label
+ *
+ * name = label name
+ */
+void list_label(char *name)
+{
+	if (list_ntot == list_stot) {
+		list_stot = list_stot ? list_stot * 2 : LIST_LABELS;
+		if (!(list_tot = (struct ltotal *) realloc(list_tot, sizeof(struct ltotal) * list_stot))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+	}
+
+	list_cur = &list_tot[list_ntot++];
+	strncpy(list_cur->name, name, sizeof(list_cur->name) - 1);
+	list_cur->name[sizeof(list_cur->name) - 1] = 0;
+	list_cur->hi = list_cur->lo = 0;
+}
+
+/*
+ * formats a cycle count, both counts are only shown if they differ
+ *
+ * out = where to put the text
+ * hi = T-states if branches are taken
+ * lo = T-states if branches are not taken
+ */
+void list_tstr(char *out, long hi, long lo)
+{
+	if (hi == lo)
+		sprintf(out, "%ld", hi);
+	else
+		sprintf(out, "%ld/%ld", hi, lo);
+}
+
+/*
+ * reads the next line of the source being echoed
+ * returns 1 if a line was read
+ */
+char list_read()
+{
+	ssize_t n;
+
+	if (!list_src || (n = getline(&list_text, &list_tsize, list_src)) < 0)
+		return 0;
+
+	while (n && (list_text[n-1] == '\n' || list_text[n-1] == '\r'))
+		list_text[--n] = 0;
+
+	list_sline++;
+	return 1;
+}
+
+/*
+ * writes out a row of bytes
+ *
+ * addr = segment relative address of first byte
+ * start = index of the first byte on the line
+ * pad = pad out the row so more columns can follow
+ */
+void list_row(uint16_t addr, int start, char pad)
+{
+	char bytes[LIST_ROW * 3 + 1];
+	int i;
+
+	bytes[0] = 0;
+	if (list_seg != 3) {
+		for (i = start; i < start + LIST_ROW && i < list_count; i++)
+			sprintf(bytes + (i - start) * 3, "%02X ", list_buf[i]);
+	}
+
+	if (pad)
+		fprintf(list_file, "%c %04X  %-14s", " tdb"[(int) list_seg], addr, bytes);
+	else
+		fprintf(list_file, "%c %04X  %.*s\n", " tdb"[(int) list_seg], addr, (int) strlen(bytes) - 1, bytes);
+}
+
+/*
+ * writes out the current line, along with its source text
+ *
+ * file = argument index of source
+ * line = line number in source
+ */
+void list_line(int file, int line)
+{
+	char cyc[16], tot[24];
+	char *text;
+	int i;
+
+	// catch the source up to the line
+	if (!list_src || file != list_sfile || line <= list_sline) {
+		if (list_src)
+			fclose(list_src);
+
+		list_src = fopen(sio_name(file), "r");
+		list_sfile = file;
+		list_sline = 0;
+	}
+
+	// lines with no tokens of their own, like the inside of a string
+	while (list_sline < line - 1 && list_read())
+		fprintf(list_file, "%-41s%s\n", "", list_text);
+
+	text = list_read() ? list_text : "";
+
+	// address and bytes
+	if (list_seg)
+		list_row(list_addr, 0, 1);
+	else
+		fprintf(list_file, "%-22s", "");
+
+	// cycles
+	cyc[0] = tot[0] = 0;
+	if (list_isr) {
+		list_tstr(cyc, list_hi, list_lo);
+		if (list_cur)
+			list_tstr(tot, list_cur->hi, list_cur->lo);
+	}
+	fprintf(list_file, "%-9s%-10s%s\n", cyc, tot, text);
+
+	// rest of the bytes
+	if (list_seg && list_seg != 3) {
+		for (i = LIST_ROW; i < list_count; i += LIST_ROW)
+			list_row(list_addr + i, i, 0);
+	}
+
+	list_clear();
+}
+
+/*
+ * writes out the label totals and closes the listing
+ */
+void list_close()
+{
+	char tot[24];
+	int i;
+
+	if (!list_file)
+		return;
+
+	if (list_ntot) {
+		fprintf(list_file, "\n%-10s%s\n", "label", "cycles");
+		for (i = 0; i < list_ntot; i++) {
+			list_tstr(tot, list_tot[i].hi, list_tot[i].lo);
+			fprintf(list_file, "%-10s%s\n", list_tot[i].name, tot);
+		}
+	}
+
+	if (list_src)
+		fclose(list_src);
+	fclose(list_file);
+	list_src = NULL;
+	list_file = NULL;
+}
+
+/*
+ * closes the listing after an error, it is thrown away
+ */
+void list_abort()
+{
+	if (!list_file)
+		return;
+
+	if (list_src)
+		fclose(list_src);
+	fclose(list_file);
+	list_src = NULL;
+	list_file = NULL;
+
+	remove(list_name);
+}
@@ -0,0 +1,41 @@
+#ifndef LIST_H
+#define LIST_H
+
+/* includes */
+#include <stdint.h>
+
+/* defines */
+
+/* bytes kept for a single line, before more room is made */
+#define LIST_BYTES 64
+
+/* bytes shown on each row */
+#define LIST_ROW 4
+
+/* labels kept for the totals, before more room is made */
+#define LIST_LABELS 64
+
+/* structs */
+
+/*
+ * running cycle total for a label
+ */
+struct ltotal {
+	char name[20];
+	long hi;
+	long lo;
+};
+
+/* interface functions */
+
+void list_open(char *name);
+void list_close();
+void list_abort();
+char list_active();
+void list_clear();
+void list_byte(char seg, uint16_t addr, uint8_t b);
+void list_cycles(int hi, int lo);
+void list_label(char *name);
+void list_line(int file, int line);
+
+#endif
@@ -1,14 +1,42 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/inotify.h>
 
 #include "sio.h"
+#include "lex.h"
 #include "asm.h"
+#include "stat.h"
+#include "list.h"
+#include "page.h"
+#include "stk.h"
 
 #define VERSION "1.0"
 
 /* flags */
 char flagv = 0;
 char flagg = 0;
+char flagw = 0;
+char flags = 0;
+char flagk = 0;
+
+/* memory for paged tables, 0 if there is no limit */
+long pcache = 0;
+
+/* output file */
+char *oname = NULL;
+
+/* listing file */
+char *lname = NULL;
+
+/* source arguments */
+char **srcv;
+int srcc;
 
 /* arg zero */
 char *argz;
@@ -18,56 +46,263 @@ char *argz;
  */
 void usage()
 {
-	printf("usage: %s [-vg] source.s ...\n", argz);
+	printf("usage: %s [-vgpjOL] [-o out] [-l out.lst] [--pch file.pch] [--emit-pch] [--watch] [--stats[=json]] [--stack[=json]] [--z80-budget n] [--page-cache n] source.s ...\n", argz);
+	printf("       %s --stack-sum[=json] report.json ...\n", argz);
 	exit(1);
 }
 
+/*
+ * returns a monotonic time in microseconds
+ */
+long long now()
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * assembles once, reporting how long it took
+ * errors are recovered from so the watch can carry on
+ */
+void watch_run()
+{
+	jmp_buf recover;
+	long long t;
+	
+	t = now();
+	asm_recover = &recover;
+	
+	if (!setjmp(recover)) {
+		sio_open(srcc, srcv, oname);
+		if (lname)
+			list_open(lname);
+		asm_assemble(flagg, flagv);
+		list_close();
+		sio_close();
+		t = now() - t;
+		printf("assembled %s in %lld.%03lld ms\n", oname, t / 1000, t % 1000);
+		if (flags)
+			stat_print(flags > 1);
+	} else {
+		list_close();
+		t = now() - t;
+		printf("failed after %lld.%03lld ms\n", t / 1000, t % 1000);
+	}
+	
+	fflush(stdout);
+}
+
+/*
+ * re-assembles every time one of the sources is written
+ * the directories are watched, so editors that replace files are caught too
+ */
+void watch()
+{
+	int ino, i, n, changed;
+	int *wds;
+	char **base, *copy, *p;
+	char buf[4096];
+	struct inotify_event *ev;
+	struct pollfd pfd;
+	
+	if ((ino = inotify_init()) < 0) {
+		printf("cannot watch sources\n");
+		exit(1);
+	}
+	
+	wds = (int *) malloc(sizeof(int) * srcc);
+	base = (char **) malloc(sizeof(char *) * srcc);
+	for (i = 1; i < srcc; i++) {
+		copy = strdup(srcv[i]);
+		base[i] = strdup(basename(copy));
+		strcpy(copy, srcv[i]);
+		
+		if ((wds[i] = inotify_add_watch(ino, dirname(copy), IN_CLOSE_WRITE | IN_MOVED_TO)) < 0) {
+			printf("cannot watch %s\n", srcv[i]);
+			exit(1);
+		}
+		free(copy);
+	}
+	
+	// keep sources in memory between runs, along with their tokens
+	sio_hold(srcc);
+	lex_split = 1;
+	lex_keep = 1;
+	
+	pfd.fd = ino;
+	pfd.events = POLLIN;
+	while (1) {
+		watch_run();
+		
+		// wait for a change, then let things settle down a bit
+		changed = 0;
+		while (!changed || poll(&pfd, 1, 20) > 0) {
+			if ((n = read(ino, buf, sizeof(buf))) < 0) {
+				if (errno == EINTR)
+					continue;
+				printf("cannot watch sources\n");
+				exit(1);
+			}
+			
+			for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+				ev = (struct inotify_event *) p;
+				if (!ev->len)
+					continue;
+				
+				for (i = 1; i < srcc; i++) {
+					if (wds[i] == ev->wd && !strcmp(base[i], ev->name)) {
+						sio_drop(i);
+						lex_drop(i);
+						changed = 1;
+					}
+				}
+			}
+		}
+	}
+}
+
 
 int main(int argc, char *argv[])
 {
 	int i, o;
-	
+
 	argz = argv[0];
-	
+
+	// sources are collected separately, so option arguments are not assembled
+	srcv = (char **) malloc(sizeof(char *) * (argc + 1));
+	srcv[0] = argv[0];
+	srcc = 1;
+
 	// flag switch
 	for (i = 1; i < argc; i++) {
-		if (argv[i][0] == '-') {
+		if (argv[i][0] == '-' && argv[i][1] == '-') {
+			// long options
+			if (!strcmp(argv[i], "--emit-pch")) {
+				pch_out++;
+			} else if (!strcmp(argv[i], "--watch")) {
+				flagw++;
+			} else if (!strcmp(argv[i], "--stats")) {
+				flags = 1;
+			} else if (!strcmp(argv[i], "--stats=json")) {
+				flags = 2;
+			} else if (!strcmp(argv[i], "--stack")) {
+				asm_stack = 1;
+			} else if (!strcmp(argv[i], "--stack=json")) {
+				asm_stack = 2;
+			} else if (!strcmp(argv[i], "--stack-sum")) {
+				flagk = 1;
+			} else if (!strcmp(argv[i], "--stack-sum=json")) {
+				flagk = 2;
+			} else if (!strcmp(argv[i], "--z80-budget")) {
+				if (++i == argc || (z80_budget = strtol(argv[i], NULL, 0)) <= 0)
+					usage();
+			} else if (!strcmp(argv[i], "--page-cache")) {
+				if (++i == argc || (pcache = strtol(argv[i], NULL, 0)) < PAGE_SIZE)
+					usage();
+			} else if (!strcmp(argv[i], "--pch")) {
+				if (++i == argc)
+					usage();
+				pch_in = argv[i];
+			} else
+				usage();
+		} else if (argv[i][0] == '-') {
 			o = 1;
 			while (argv[i][o]) {
 				switch (argv[i][o++]) {
 					case 'g':
 						flagg++;
 						break;
-						
+
 					case 'v':
 						flagv++;
 						break;
-						
+
+					case 'p':
+						lex_piped++;
+						break;
+
+					case 'j':
+						lex_split++;
+						break;
+
+					case 'O':
+						asm_opt++;
+						break;
+
+					case 'L':
+						asm_lines++;
+						break;
+
+					case 'o':
+						// grab the next argument
+						if (++i == argc)
+							usage();
+						oname = argv[i];
+						goto next_arg;
+
+					case 'l':
+						// grab the next argument
+						if (++i == argc)
+							usage();
+						lname = argv[i];
+						goto next_arg;
+
 					default:
 						usage();
 				}
 			}
+		} else {
+			srcv[srcc++] = argv[i];
 		}
+next_arg:;
 	}
+	srcv[srcc] = NULL;
 
 	// check to see if there are any actual arguments
-	o = 1;
-	for (i = 1; i < argc; i++)
-		if (argv[i][0] != '-')
-			o = 0;
-	if (o)
+	if (srcc == 1)
 		usage();
-	
+
+	// the arguments are stack reports to add up, nothing is assembled
+	if (flagk) {
+		for (i = 1; i < srcc; i++)
+			stk_load(srcv[i]);
+		stk_sum(flagk > 1);
+		stk_done(flagk > 1);
+		return 0;
+	}
+
+	// default output
+	if (!oname)
+		oname = pch_out ? "a.pch" : "a.out";
+
 	// intro message
 	if (flagv)
 		printf("TRASM cross assembler v%s\n", VERSION);
+
+	// tables are paged out past this
+	page_open(pcache, asm_error);
 	
+	// watch mode never returns
+	if (flagw)
+		watch();
+
 	// open up the source files
-	sio_open(argc, argv);
-	
+	sio_open(srcc, srcv, oname);
+
+	// open up the listing
+	if (lname)
+		list_open(lname);
+
 	// do the assembly
 	asm_assemble(flagg, flagv);
-	
+
 	// all done
+	list_close();
 	sio_close();
-} 
\ No newline at end of file
+	page_close();
+	
+	if (flags)
+		stat_print(flags > 1);
+}
\ No newline at end of file
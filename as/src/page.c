@@ -0,0 +1,366 @@
+/*
+ * page.c
+ *
+ * paged tables, so large sources can be assembled with a fixed amount of memory
+ * pages that do not fit are written out to a scratch file, and read back in when needed
+ */
+#include "page.h"
+#include "stat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* most tables that can be paged */
+#define PAGE_TABLES 4
+
+/* most slots allowed, 0 if there is no limit */
+long page_cap;
+int page_nslot;
+
+/* called when the pages needed do not fit, does not return */
+void (*page_full)(char *msg);
+
+/* all slots, most recently used first */
+struct pslot *page_head;
+struct pslot *page_tail;
+
+/* tables being paged */
+struct ptable *page_tab[PAGE_TABLES];
+int page_ntab;
+
+/* pages handed out since the last safe point cannot be paged out */
+long page_gen = 1;
+
+/* scratch file */
+FILE *page_file;
+long page_end;
+
+/*
+ * sets how much memory pages can take up
+ *
+ * cap = bytes of Z80 memory for pages, 0 if there is no limit
+ * full = error handler for when a line needs more pages than fit
+ */
+void page_open(long cap, void (*full)(char *msg))
+{
+	page_cap = cap / PAGE_SIZE;
+	page_full = full;
+
+	if (page_cap && !(page_file = tmpfile())) {
+		printf("cannot open page file\n");
+		exit(1);
+	}
+}
+
+/*
+ * closes the scratch file
+ */
+void page_close()
+{
+	if (page_file)
+		fclose(page_file);
+	page_file = NULL;
+}
+
+/*
+ * sets up a table, and adds it to the tables being paged
+ *
+ * t = table
+ * size = host size of a record
+ * z80 = Z80 size of a record
+ */
+void page_init(struct ptable *t, int size, int z80)
+{
+	if (page_ntab == PAGE_TABLES) {
+		printf("too many paged tables\n");
+		exit(1);
+	}
+	page_tab[page_ntab++] = t;
+
+	t->size = size;
+	t->per = page_cap ? PAGE_SIZE / z80 : PAGE_FLAT;
+	t->count = 0;
+	t->npage = 0;
+	t->spage = 0;
+	t->slot = NULL;
+	t->off = NULL;
+}
+
+/*
+ * throws away all tables and their pages
+ */
+void page_reset()
+{
+	struct pslot *s, *next;
+	int i;
+
+	for (s = page_head; s; s = next) {
+		next = s->next;
+		free(s->data);
+		free(s);
+	}
+	page_head = page_tail = NULL;
+	page_nslot = 0;
+
+	for (i = 0; i < page_ntab; i++) {
+		free(page_tab[i]->slot);
+		free(page_tab[i]->off);
+		page_tab[i]->slot = NULL;
+		page_tab[i]->off = NULL;
+	}
+	page_ntab = 0;
+
+	// nothing in the scratch file is needed anymore
+	page_end = 0;
+}
+
+/*
+ * moves a slot to the front of the used list
+ *
+ * s = slot
+ */
+void page_touch(struct pslot *s)
+{
+	if (s == page_head)
+		return;
+
+	// unlink
+	s->prev->next = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+	else
+		page_tail = s->prev;
+
+	// link in at the front
+	s->prev = NULL;
+	s->next = page_head;
+	page_head->prev = s;
+	page_head = s;
+}
+
+/*
+ * writes a page out to the scratch file if it was changed, freeing its slot
+ *
+ * s = slot
+ */
+void page_out(struct pslot *s)
+{
+	struct ptable *t;
+	int bytes;
+
+	t = s->table;
+	bytes = t->per * t->size;
+	t->slot[s->page] = NULL;
+
+	// the copy in the scratch file is still good
+	if (!s->dirty)
+		return;
+
+	if (t->off[s->page] < 0) {
+		t->off[s->page] = page_end;
+		page_end += bytes;
+	}
+
+	if (fseek(page_file, t->off[s->page], SEEK_SET) || fwrite(s->data, bytes, 1, page_file) != 1) {
+		printf("cannot write page file\n");
+		exit(1);
+	}
+
+	stat_pageout++;
+}
+
+/*
+ * finds a slot for a page of a table
+ * the least recently used page that is not needed is paged out, if there is no room
+ *
+ * t = table
+ */
+struct pslot *page_slot(struct ptable *t)
+{
+	struct pslot *s;
+	int bytes;
+
+	bytes = t->per * t->size;
+
+	// find a page to throw out
+	s = NULL;
+	if (page_cap && page_nslot >= page_cap) {
+		for (s = page_tail; s; s = s->prev)
+			if (s->held != page_gen)
+				break;
+
+		// every page is in use by the line being assembled
+		if (!s)
+			page_full("page cache too small");
+	}
+
+	if (s) {
+		page_out(s);
+	} else {
+		// there is room
+		if (!(s = (struct pslot *) calloc(1, sizeof(struct pslot)))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+		page_nslot++;
+
+		s->next = page_head;
+		if (page_head)
+			page_head->prev = s;
+		else
+			page_tail = s;
+		page_head = s;
+	}
+
+	if (s->size < bytes) {
+		if (!(s->data = (uint8_t *) realloc(s->data, bytes))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+		stat_heap += bytes - s->size;
+		s->size = bytes;
+	}
+
+	s->table = t;
+	s->dirty = 0;
+	s->held = 0;
+	return s;
+}
+
+/*
+ * brings a page of a table into memory
+ *
+ * t = table
+ * p = page number
+ */
+struct pslot *page_in(struct ptable *t, int p)
+{
+	struct pslot *s;
+	int bytes;
+
+	s = page_slot(t);
+	s->page = p;
+	t->slot[p] = s;
+
+	bytes = t->per * t->size;
+	if (t->off[p] < 0) {
+		memset(s->data, 0, bytes);
+	} else {
+		if (fseek(page_file, t->off[p], SEEK_SET) || fread(s->data, bytes, 1, page_file) != 1) {
+			printf("cannot read page file\n");
+			exit(1);
+		}
+		stat_pagein++;
+	}
+
+	return s;
+}
+
+/*
+ * returns a record in a table
+ * held records stay in memory until the next safe point, and are written back when paged out
+ *
+ * t = table
+ * rec = record number
+ * hold = set if the record is going to be used after another record is fetched, or changed
+ */
+void *page_get(struct ptable *t, int rec, char hold)
+{
+	struct pslot *s;
+	int p;
+
+	p = rec / t->per;
+	if (!(s = t->slot[p]))
+		s = page_in(t, p);
+
+	if (page_cap) {
+		page_touch(s);
+		if (hold) {
+			s->held = page_gen;
+			s->dirty = 1;
+		}
+	}
+
+	return s->data + (rec % t->per) * t->size;
+}
+
+/*
+ * returns a record in a table, for walking through it in order
+ * the records after it in the same page can be reached by pointer until left runs out
+ *
+ * t = table
+ * rec = record number
+ * left = set to how many records follow it in the page
+ * write = set if records in the page are going to be changed
+ */
+void *page_run(struct ptable *t, int rec, int *left, char write)
+{
+	struct pslot *s;
+	int p;
+
+	p = rec / t->per;
+	if (!(s = t->slot[p]))
+		s = page_in(t, p);
+
+	if (page_cap) {
+		page_touch(s);
+		if (write)
+			s->dirty = 1;
+	}
+
+	*left = t->per - rec % t->per - 1;
+	return s->data + (rec % t->per) * t->size;
+}
+
+/*
+ * adds a record to the end of a table
+ * it will be zeroed and held
+ *
+ * t = table
+ */
+void *page_add(struct ptable *t)
+{
+	if (t->count == t->npage * t->per) {
+		if (t->npage == t->spage) {
+			t->spage = t->spage ? t->spage * 2 : 64;
+			t->slot = (struct pslot **) realloc(t->slot, sizeof(struct pslot *) * t->spage);
+			t->off = (long *) realloc(t->off, sizeof(long) * t->spage);
+			if (!t->slot || !t->off) {
+				printf("out of memory\n");
+				exit(1);
+			}
+		}
+
+		t->slot[t->npage] = NULL;
+		t->off[t->npage++] = -1;
+	}
+
+	return page_get(t, t->count++, 1);
+}
+
+/*
+ * returns if pages are being written out past a cap
+ */
+char page_limited()
+{
+	return page_cap != 0;
+}
+
+/*
+ * returns the Z80 memory taken up by pages in memory, 0 if there is no cap
+ */
+long page_bytes()
+{
+	return page_cap ? (long) page_nslot * PAGE_SIZE : 0;
+}
+
+/*
+ * marks a safe point, records handed out before now are no longer being used
+ */
+void page_safe()
+{
+	// nothing is paged out without a cap
+	if (page_cap)
+		page_gen++;
+}
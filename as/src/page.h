@@ -0,0 +1,57 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+/* includes */
+#include <stdint.h>
+
+/* defines */
+
+/* bytes of Z80 memory in a page */
+#define PAGE_SIZE 256
+
+/* records in a page when nothing is paged out, so tables are close to flat */
+#define PAGE_FLAT 4096
+
+/* structs */
+
+/*
+ * a page sized piece of memory, holding one page of a table
+ */
+struct pslot {
+	struct ptable *table;
+	int page;
+	int size; // bytes allocated for data
+	char dirty; // changed since it was read in
+	long held; // generation it was last handed out in
+	uint8_t *data;
+	struct pslot *prev; // more recently used
+	struct pslot *next; // less recently used
+};
+
+/*
+ * a table of fixed size records, kept in pages
+ */
+struct ptable {
+	int size; // host size of a record
+	int per; // records in a page
+	int count; // records in table
+	int npage;
+	int spage;
+	struct pslot **slot; // where each page is, NULL if paged out
+	long *off; // where each page is in the scratch file, -1 if never written
+};
+
+/* interface functions */
+
+void page_open(long cap, void (*full)(char *msg));
+void page_close();
+void page_init(struct ptable *t, int size, int z80);
+void page_reset();
+void *page_get(struct ptable *t, int rec, char hold);
+void *page_run(struct ptable *t, int rec, int *left, char write);
+void *page_add(struct ptable *t);
+char page_limited();
+long page_bytes();
+void page_safe();
+
+#endif
@@ -7,6 +7,7 @@
  
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 //todo: fix bytewise i/o on fout and tmp files
@@ -17,18 +18,26 @@ int sio_argc;
 int sio_argi;
 
 /* buffer state stuff */
-char sio_buf[512];
+char sio_blk[512];
+char *sio_buf;
 int sio_bufc;
 int sio_bufi;
 
+/* sources held in memory between assemblies */
+char sio_held;
+char **sio_hbuf;
+int *sio_hsize;
+
 /* current line number */
 int sio_line;
 
 /* currently open file */
 FILE *sio_curr;
 
-/* output file */
+/* output file, written under a temporary name until closed */
 FILE *sio_fout;
+char *sio_oname;
+char *sio_otmp;
 
 /* tmp file */
 FILE *sio_ftmp;
@@ -36,6 +45,108 @@ FILE *sio_ftmp;
 /* pid */
 char tname[32];
 
+/*
+ * reads an entire source into memory to be held
+ *
+ * i = argument index of source
+ * returns 1 if successful
+ */
+int sio_load(int i)
+{
+	FILE *f;
+	long size;
+	
+	if (!(f = fopen(sio_argv[i], "r")))
+		return 0;
+	
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	
+	if (!(sio_hbuf[i] = (char *) malloc(size + 1))) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	sio_hsize[i] = fread(sio_hbuf[i], 1, size, f);
+	fclose(f);
+	
+	return 1;
+}
+
+/*
+ * holds sources in memory once read, so they do not need to be read again
+ *
+ * argc = argument count
+ */
+void sio_hold(int argc)
+{
+	if (sio_held)
+		return;
+	
+	sio_held = 1;
+	sio_hbuf = (char **) calloc(argc, sizeof(char *));
+	sio_hsize = (int *) calloc(argc, sizeof(int));
+	
+	if (!sio_hbuf || !sio_hsize) {
+		printf("out of memory\n");
+		exit(1);
+	}
+}
+
+/*
+ * drops a held source, so it will be read again
+ *
+ * i = argument index of source
+ */
+void sio_drop(int i)
+{
+	free(sio_hbuf[i]);
+	sio_hbuf[i] = NULL;
+}
+
+/*
+ * returns the number of arguments being assembled, including arg zero
+ */
+int sio_count()
+{
+	return sio_argc;
+}
+
+/*
+ * returns the name of a source
+ *
+ * i = argument index of source
+ */
+char *sio_name(int i)
+{
+	return sio_argv[i];
+}
+
+/*
+ * returns an entire source held in memory, reading it in if needed
+ * sources must be held first, different sources can be asked for from different threads
+ *
+ * i = argument index of source
+ * size = where to put the size of the source
+ * returns the source, or NULL if it cannot be read
+ */
+char *sio_source(int i, int *size)
+{
+	*size = 0;
+	
+	// do not open arguments that start with '-'
+	if (sio_argv[i][0] == '-')
+		return NULL;
+	
+	if (!sio_hbuf[i] && !sio_load(i)) {
+		printf("%s?\n", sio_argv[i]);
+		return NULL;
+	}
+	
+	*size = sio_hsize[i];
+	return sio_hbuf[i];
+}
+
 /*
  * loads up the first block of the next file
  */
@@ -56,9 +167,26 @@ void sio_nextfile()
 		// do not open arguments that start with '-'
 		if (sio_argv[sio_argi][0] == '-')
 			continue;
+		
+		// serve held sources straight out of memory
+		if (sio_held) {
+			if (!sio_hbuf[sio_argi] && !sio_load(sio_argi)) {
+				printf("%s?\n", sio_argv[sio_argi]);
+				continue;
+			}
+			
+			sio_buf = sio_hbuf[sio_argi];
+			sio_bufc = sio_hsize[sio_argi];
+			sio_bufi = 0;
+			
+			if (sio_bufc)
+				break;
+			continue;
+		}
 
 		if ((sio_curr = fopen(sio_argv[sio_argi], "r"))) {
 			
+			sio_buf = sio_blk;
 			sio_bufi = 0;
 			
 			// attempt to read the initial block
@@ -82,16 +210,25 @@ void sio_nextfile()
  *
  * argc = argument count
  * argv = array of arguments
+ * oname = output file name
  */
-void sio_open(int argc, char *argv[])
+void sio_open(int argc, char *argv[], char *oname)
 {
 	sio_argv = argv;
 	sio_argc = argc;
 
 	sprintf(tname, "/tmp/atm%d", getpid());
+	
+	// output goes next to its final name, and is moved into place when closed
+	sio_oname = oname;
+	if (!sio_otmp && !(sio_otmp = (char *) malloc(strlen(oname) + 16))) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	sprintf(sio_otmp, "%s.%d", oname, getpid());
 
-	if (!(sio_fout = fopen("a.out", "wb"))) {
-		printf("cannot open a.out\n");
+	if (!(sio_fout = fopen(sio_otmp, "wb"))) {
+		printf("cannot open %s\n", oname);
 		exit(1);
 	}
 	
@@ -105,7 +242,7 @@ void sio_open(int argc, char *argv[])
 }
 
 /*
- * closes source files when done
+ * closes source files when done, and moves the output into place
  */
 void sio_close()
 {
@@ -118,6 +255,27 @@ void sio_close()
 	
 	// delete temp file
 	remove(tname);
+	
+	if (rename(sio_otmp, sio_oname)) {
+		printf("cannot write %s\n", sio_oname);
+		remove(sio_otmp);
+	}
+}
+
+/*
+ * closes source files after an error, the output is thrown away
+ */
+void sio_abort()
+{
+	if (sio_curr) fclose(sio_curr);
+	if (sio_fout) fclose(sio_fout);
+	if (sio_ftmp) fclose(sio_ftmp);
+	sio_curr = NULL;
+	sio_fout = NULL;
+	sio_ftmp = NULL;
+	
+	remove(tname);
+	remove(sio_otmp);
 }
 
 /*
@@ -141,20 +299,20 @@ char sio_next()
 	
 	out = sio_buf[sio_bufi];
 	
+	// count the line break before a new file resets the count
+	if (out == '\n') sio_line++;
+	
 	// if there is still bytes is the buffer, find the next one
 	
 	if (++sio_bufi >= sio_bufc) {
 			// attempt to read the next block
-			if (0 < (sio_bufc = fread(sio_buf, 1, 512, sio_curr))) {
+			if (sio_curr && 0 < (sio_bufc = fread(sio_buf, 1, 512, sio_curr))) {
 				sio_bufi = 0;
 			} else {
 				sio_nextfile();
 			}
 	}
 	
-	// if we have just passed a line break, increment the pointer
-	if (out == '\n') sio_line++;
-	
 	return out;
 }
 
@@ -169,11 +327,26 @@ void sio_rewind()
 }
 
 /*
- * prints the current state of the input, whatever that looks like
+ * returns the current position in the input
+ *
+ * file = where to put the argument index of the source
+ * line = where to put the line number
+ */
+void sio_pos(int *file, int *line)
+{
+	*file = (sio_argi < sio_argc) ? sio_argi : sio_argc-1;
+	*line = sio_line;
+}
+
+/*
+ * prints a position in the input, whatever that looks like
+ *
+ * file = argument index of the source
+ * line = line number
  */
-void sio_status()
+void sio_status(int file, int line)
 {
-	printf("%s:%d", (sio_argi < sio_argc) ? sio_argv[sio_argi] : sio_argv[sio_argc-1], sio_line);
+	printf("%s:%d", sio_argv[file], line);
 }
 
 /*
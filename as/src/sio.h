@@ -2,12 +2,19 @@
 #define SIO_H
 
 /* These are the functions needed to interface with the rest of the assembler */
-void sio_open(int argc, char *argv[]);
+void sio_open(int argc, char *argv[], char *oname);
 void sio_close();
+void sio_abort();
+void sio_hold(int argc);
+void sio_drop(int i);
+int sio_count();
+char *sio_name(int i);
+char *sio_source(int i, int *size);
 char sio_peek();
 char sio_next();
 void sio_rewind();
-void sio_status();
+void sio_pos(int *file, int *line);
+void sio_status(int file, int line);
 
 void sio_out(char out);
 
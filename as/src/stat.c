@@ -0,0 +1,143 @@
+/*
+ * stat.c
+ *
+ * timing and counters for finding out where assembly time goes
+ */
+#include "stat.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/* counters */
+long stat_tokens;
+long stat_lookups;
+long stat_probes;
+long stat_llookups;
+long stat_lprobes;
+long stat_exprs;
+long stat_relocs;
+long stat_seg[4];
+long stat_heap;
+long stat_pagein;
+long stat_pageout;
+
+/* time spent in each phase, in microseconds */
+long long stat_wall[STAT_PHASES];
+long long stat_cpu[STAT_PHASES];
+
+/* when the last phase ended */
+long long stat_lwall;
+long long stat_lcpu;
+
+/* phase names */
+char *stat_names[] = {"pass1", "fix_seg", "pass2", "append", "meta"};
+
+/*
+ * reads a clock in microseconds
+ *
+ * id = clock to read
+ */
+long long stat_clock(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * clears all counters and starts timing the first phase
+ */
+void stat_reset()
+{
+	int i;
+
+	stat_tokens = stat_lookups = stat_probes = 0;
+	stat_llookups = stat_lprobes = 0;
+	stat_exprs = stat_relocs = stat_heap = 0;
+	stat_pagein = stat_pageout = 0;
+
+	for (i = 0; i < 4; i++)
+		stat_seg[i] = 0;
+
+	for (i = 0; i < STAT_PHASES; i++)
+		stat_wall[i] = stat_cpu[i] = 0;
+
+	stat_lwall = stat_clock(CLOCK_MONOTONIC);
+	stat_lcpu = stat_clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/*
+ * marks the end of a phase, time since the last mark is charged to it
+ *
+ * phase = phase that just ended
+ */
+void stat_mark(int phase)
+{
+	long long wall, cpu;
+
+	wall = stat_clock(CLOCK_MONOTONIC);
+	cpu = stat_clock(CLOCK_PROCESS_CPUTIME_ID);
+
+	stat_wall[phase] += wall - stat_lwall;
+	stat_cpu[phase] += cpu - stat_lcpu;
+
+	stat_lwall = wall;
+	stat_lcpu = cpu;
+}
+
+/*
+ * returns the average of a count over a number of events
+ *
+ * sum = total count
+ * n = number of events
+ */
+double stat_avg(long sum, long n)
+{
+	return n ? (double) sum / n : 0;
+}
+
+/*
+ * prints out everything collected during the last assembly
+ *
+ * json = print as a json object instead of a table
+ */
+void stat_print(char json)
+{
+	struct rusage ru;
+	int i;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	if (json) {
+		printf("{\"phases\": {");
+		for (i = 0; i < STAT_PHASES; i++)
+			printf("%s\"%s\": {\"wall_us\": %lld, \"cpu_us\": %lld}", i ? ", " : "", stat_names[i], stat_wall[i], stat_cpu[i]);
+		printf("}, \"tokens\": %ld", stat_tokens);
+		printf(", \"symbol_lookups\": %ld, \"symbol_chain_avg\": %.2f", stat_lookups, stat_avg(stat_probes, stat_lookups));
+		printf(", \"local_lookups\": %ld, \"local_chain_avg\": %.2f", stat_llookups, stat_avg(stat_lprobes, stat_llookups));
+		printf(", \"expressions\": %ld, \"relocations\": %ld", stat_exprs, stat_relocs);
+		printf(", \"text_bytes\": %ld, \"data_bytes\": %ld, \"bss_bytes\": %ld", stat_seg[1], stat_seg[2], stat_seg[3]);
+		printf(", \"page_ins\": %ld, \"page_outs\": %ld", stat_pagein, stat_pageout);
+		printf(", \"heap_bytes\": %ld, \"max_rss_kb\": %ld}\n", stat_heap, ru.ru_maxrss);
+		return;
+	}
+
+	printf("%-16s %12s %12s\n", "phase", "wall ms", "cpu ms");
+	for (i = 0; i < STAT_PHASES; i++)
+		printf("%-16s %12.3f %12.3f\n", stat_names[i], stat_wall[i] / 1000.0, stat_cpu[i] / 1000.0);
+
+	printf("%-16s %12ld\n", "tokens", stat_tokens);
+	printf("%-16s %12ld  avg chain %.2f\n", "symbol lookups", stat_lookups, stat_avg(stat_probes, stat_lookups));
+	printf("%-16s %12ld  avg chain %.2f\n", "local lookups", stat_llookups, stat_avg(stat_lprobes, stat_llookups));
+	printf("%-16s %12ld\n", "expressions", stat_exprs);
+	printf("%-16s %12ld\n", "relocations", stat_relocs);
+	printf("%-16s %12ld\n", "text bytes", stat_seg[1]);
+	printf("%-16s %12ld\n", "data bytes", stat_seg[2]);
+	printf("%-16s %12ld\n", "bss bytes", stat_seg[3]);
+	printf("%-16s %12ld\n", "page ins", stat_pagein);
+	printf("%-16s %12ld\n", "page outs", stat_pageout);
+	printf("%-16s %12ld\n", "heap bytes", stat_heap);
+	printf("%-16s %12ld\n", "max rss kb", ru.ru_maxrss);
+}
@@ -0,0 +1,31 @@
+#ifndef STAT_H
+#define STAT_H
+
+/* phases of assembly, in order */
+#define STAT_PASS1 0
+#define STAT_FIXSEG 1
+#define STAT_PASS2 2
+#define STAT_APPEND 3
+#define STAT_META 4
+#define STAT_PHASES 5
+
+/* counters, bumped by the rest of the assembler */
+extern long stat_tokens;
+extern long stat_lookups;
+extern long stat_probes;
+extern long stat_llookups;
+extern long stat_lprobes;
+extern long stat_exprs;
+extern long stat_relocs;
+extern long stat_seg[4];
+extern long stat_heap;
+extern long stat_pagein;
+extern long stat_pageout;
+
+/* interface functions */
+
+void stat_reset();
+void stat_mark(int phase);
+void stat_print(char json);
+
+#endif
@@ -0,0 +1,611 @@
+/*
+ * stk.c
+ *
+ * stack depth of each global routine, worked out from the encoded instructions
+ */
+#include "stk.h"
+#include "cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/* routines looked at so far */
+struct sroutine *stk_table[STK_HASH];
+
+/* depth each instruction is reached with while a routine is scanned */
+long *stk_dep;
+int *stk_work;
+char *stk_in;
+int stk_size;
+int stk_nwork;
+
+/* routines reported so far */
+int stk_count;
+
+/* routines loaded from reports, in order */
+struct sroutine *stk_first;
+struct sroutine *stk_last;
+
+/* report being loaded */
+char *stk_file;
+char *stk_json;
+
+/* flag names, in bit order */
+char *stk_names[] = {"recursive", "indirect", "sets_sp", "unbounded", "leaves"};
+
+/*
+ * adds a call to a table, only the deepest call to each callee is kept
+ *
+ * tab = table
+ * n = entries used
+ * size = entries allocated
+ * name = callee name, or NULL if it is in the text segment
+ * target = callee address
+ * depth = stack used at the call
+ */
+void stk_add(struct scall **tab, int *n, int *size, char *name, uint16_t target, long depth)
+{
+	struct scall *c;
+	int i;
+
+	for (i = 0; i < *n; i++) {
+		c = &(*tab)[i];
+		if (name ? !strcmp(c->name, name) : (!c->name[0] && c->target == target)) {
+			if (depth > c->depth)
+				c->depth = depth;
+			return;
+		}
+	}
+
+	if (*n == *size) {
+		*size = *size ? *size * 2 : 8;
+		if (!(*tab = realloc(*tab, sizeof(struct scall) * *size))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+	}
+
+	c = &(*tab)[(*n)++];
+	c->name[0] = 0;
+	if (name) {
+		strncpy(c->name, name, sizeof(c->name) - 1);
+		c->name[sizeof(c->name) - 1] = 0;
+	}
+	c->target = target;
+	c->depth = depth;
+}
+
+/*
+ * finds the routine at an address, a new one is made if needed
+ *
+ * addr = routine address
+ */
+struct sroutine *stk_find(uint16_t addr)
+{
+	struct sroutine *r;
+
+	for (r = stk_table[addr % STK_HASH]; r; r = r->next) {
+		if (r->addr == addr)
+			return r;
+	}
+
+	if (!(r = calloc(1, sizeof(struct sroutine)))) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	r->addr = addr;
+	r->next = stk_table[addr % STK_HASH];
+	stk_table[addr % STK_HASH] = r;
+
+	return r;
+}
+
+/*
+ * carries a path on to another instruction
+ *
+ * r = routine being scanned
+ * addr = address of instruction
+ * depth = stack used when it is reached
+ */
+void stk_go(struct sroutine *r, uint16_t addr, long depth)
+{
+	int i;
+
+	if ((i = cfg_find(addr)) < 0) {
+		r->flags |= STK_LEAVES;
+		return;
+	}
+
+	if (depth > STK_LIMIT) {
+		r->flags |= STK_UNBOUNDED;
+		return;
+	}
+
+	// only deeper paths need to be followed again
+	if (stk_dep[i] != LONG_MIN && depth <= stk_dep[i])
+		return;
+	stk_dep[i] = depth;
+
+	if (!stk_in[i]) {
+		stk_in[i] = 1;
+		stk_work[stk_nwork++] = i;
+	}
+}
+
+/*
+ * follows every path through a routine, finding how deep it goes by itself
+ * and what it calls
+ *
+ * r = routine to scan
+ */
+void stk_scan(struct sroutine *r)
+{
+	struct cnode *c;
+	uint16_t target;
+	char name[12];
+	int i, x;
+	long d;
+	uint8_t op;
+
+	if (stk_size < cfg_nnode) {
+		stk_size = cfg_nnode;
+		stk_dep = realloc(stk_dep, sizeof(long) * stk_size);
+		stk_work = realloc(stk_work, sizeof(int) * stk_size);
+		stk_in = realloc(stk_in, stk_size);
+		if (!stk_dep || !stk_work || !stk_in) {
+			printf("out of memory\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < cfg_nnode; i++) {
+		stk_dep[i] = LONG_MIN;
+		stk_in[i] = 0;
+	}
+
+	stk_nwork = 0;
+	stk_go(r, r->addr, 0);
+
+	while (stk_nwork) {
+		i = stk_work[--stk_nwork];
+		stk_in[i] = 0;
+		d = stk_dep[i];
+		c = &cfg_node[i];
+
+		op = c->b[0];
+		x = op == 0xDD || op == 0xFD ? c->b[1] : -1;
+
+		if (op == 0xE9 || x == 0xE9) {
+			// jp (hl), where it goes is not known
+			r->flags |= STK_INDIRECT;
+		} else if (op == 0x31 || op == 0xF9 || x == 0xF9 || (op == 0xED && c->b[1] == 0x7B)) {
+			// the stack is somewhere else now
+			r->flags |= STK_SETSP;
+		} else if (op == 0xC9 || (op == 0xED && (c->b[1] == 0x4D || c->b[1] == 0x45))) {
+			// return, the path is done
+		} else if ((op & 0xCF) == 0xC5 || x == 0xE5) {
+			// push
+			if (d + 2 > r->own)
+				r->own = d + 2;
+			stk_go(r, c->addr + c->n, d + 2);
+		} else if ((op & 0xCF) == 0xC1 || x == 0xE1) {
+			// pop
+			stk_go(r, c->addr + c->n, d - 2);
+		} else if (op == 0x33 || op == 0x3B) {
+			// inc sp, dec sp
+			if (op == 0x3B && d + 1 > r->own)
+				r->own = d + 1;
+			stk_go(r, c->addr + c->n, op == 0x33 ? d - 1 : d + 1);
+		} else if ((op & 0xC7) == 0xC7) {
+			// rst calls a fixed address, which is never in a relocatable text segment
+			if (d + 2 > r->own)
+				r->own = d + 2;
+			sprintf(name, "rst_%02X", op & 0x38);
+			stk_add(&r->term, &r->nterm, &r->sterm, name, 0, d + 2);
+			stk_go(r, c->addr + c->n, d);
+		} else if (cfg_target(c, &target) && (op == 0xCD || (op & 0xC7) == 0xC4)) {
+			// call
+			if (d + 2 > r->own)
+				r->own = d + 2;
+			if (c->ext)
+				stk_add(&r->term, &r->nterm, &r->sterm, c->ext, 0, d + 2);
+			else if (cfg_find(target) >= 0)
+				stk_add(&r->call, &r->ncall, &r->scall, NULL, target, d + 2);
+			else
+				r->flags |= STK_LEAVES;
+			stk_go(r, c->addr + c->n, d);
+		} else if (cfg_target(c, &target)) {
+			// jump, into an external it is the same as a call followed by a return
+			if (c->ext)
+				stk_add(&r->term, &r->nterm, &r->sterm, c->ext, 0, d);
+			else
+				stk_go(r, target, d);
+
+			if (op != 0xC3 && op != 0x18)
+				stk_go(r, c->addr + c->n, d);
+		} else {
+			// conditional returns carry on too
+			stk_go(r, c->addr + c->n, d);
+		}
+	}
+}
+
+/*
+ * works out how deep a routine goes, along with the callees it can see
+ *
+ * r = routine
+ */
+void stk_total(struct sroutine *r)
+{
+	struct sroutine *callee;
+	struct scall *c, *t;
+	int i, j;
+
+	if (r->done)
+		return;
+
+	stk_scan(r);
+	r->busy = 1;
+	r->total = r->own;
+
+	for (i = 0; i < r->ncall; i++) {
+		c = &r->call[i];
+		callee = stk_find(c->target);
+		if (callee->busy) {
+			r->flags |= STK_RECURSIVE;
+			continue;
+		}
+
+		stk_total(callee);
+		r->flags |= callee->flags;
+		if (c->depth + callee->total > r->total)
+			r->total = c->depth + callee->total;
+
+		for (j = 0; j < callee->nterm; j++) {
+			t = &callee->term[j];
+			stk_add(&r->term, &r->nterm, &r->sterm, t->name, 0, c->depth + t->depth);
+		}
+	}
+
+	r->busy = 0;
+	r->done = 1;
+}
+
+/*
+ * prints the stack depth of a routine
+ *
+ * name = routine name
+ * r = routine
+ * json = print as part of a json object instead of a table
+ */
+void stk_print(char *name, struct sroutine *r, char json)
+{
+	int i, n;
+
+	if (json) {
+		printf("%s{\"name\": \"%.8s\", \"depth\": %ld, \"externals\": {", stk_count ? ", " : "{\"routines\": [", name, r->total);
+		for (i = 0; i < r->nterm; i++)
+			printf("%s\"%s\": %ld", i ? ", " : "", r->term[i].name, r->term[i].depth);
+		printf("}, \"flags\": [");
+		for (i = n = 0; i < 5; i++) {
+			if (r->flags & (1 << i))
+				printf("%s\"%s\"", n++ ? ", " : "", stk_names[i]);
+		}
+		printf("]}");
+	} else {
+		if (!stk_count)
+			printf("%-10s %6s  %s\n", "routine", "depth", "externals and flags");
+		printf("%-10.8s %6ld ", name, r->total);
+		for (i = 0; i < r->nterm; i++)
+			printf(" %s+%ld", r->term[i].name, r->term[i].depth);
+		for (i = 0; i < 5; i++) {
+			if (r->flags & (1 << i))
+				printf(" %s", stk_names[i]);
+		}
+		printf("\n");
+	}
+
+	stk_count++;
+}
+
+/*
+ * reports the stack depth of a global routine
+ *
+ * name = routine name
+ * addr = routine address
+ * json = print as part of a json object instead of a table
+ */
+void stk_report(char *name, uint16_t addr, char json)
+{
+	struct sroutine *r;
+
+	r = stk_find(addr);
+	stk_total(r);
+	stk_print(name, r, json);
+}
+
+/*
+ * hashes a routine name, 32 bit FNV-1a
+ *
+ * name = routine name
+ */
+uint32_t stk_hash(char *name)
+{
+	uint32_t h;
+
+	h = 2166136261u;
+	while (*name)
+		h = (h ^ (uint8_t) *name++) * 16777619u;
+
+	return h;
+}
+
+/*
+ * finds a routine loaded from a report
+ *
+ * name = routine name
+ * returns the routine, or NULL if no report has it
+ */
+struct sroutine *stk_named(char *name)
+{
+	struct sroutine *r;
+
+	for (r = stk_table[stk_hash(name) % STK_HASH]; r; r = r->next) {
+		if (!strcmp(r->name, name))
+			return r;
+	}
+
+	return NULL;
+}
+
+/*
+ * gives up on a report that cannot be read
+ */
+void stk_bad()
+{
+	printf("bad stack report %s\n", stk_file);
+	exit(1);
+}
+
+/*
+ * moves past some expected text in a report, white space around it is skipped
+ *
+ * s = expected text
+ * returns true (1) if it was there, or false (0)
+ */
+char stk_take(char *s)
+{
+	while (*stk_json == ' ' || *stk_json == '\n')
+		stk_json++;
+
+	if (strncmp(stk_json, s, strlen(s)))
+		return 0;
+
+	stk_json += strlen(s);
+	return 1;
+}
+
+/*
+ * reads a quoted string from a report
+ *
+ * out = where to put the string, 12 bytes
+ */
+void stk_str(char *out)
+{
+	int i;
+
+	if (!stk_take("\""))
+		stk_bad();
+
+	for (i = 0; *stk_json && *stk_json != '"'; stk_json++)
+		if (i < 11)
+			out[i++] = *stk_json;
+	out[i] = 0;
+
+	if (!stk_take("\""))
+		stk_bad();
+}
+
+/*
+ * reads a number from a report
+ */
+long stk_num()
+{
+	char *end;
+	long n;
+
+	n = strtol(stk_json, &end, 10);
+	if (end == stk_json)
+		stk_bad();
+	stk_json = end;
+
+	return n;
+}
+
+/*
+ * loads the routines from a report written by --stack=json
+ * anything printed before the report is skipped over
+ *
+ * file = report file
+ */
+void stk_load(char *file)
+{
+	struct sroutine *r;
+	FILE *f;
+	long size, depth;
+	char name[12], *buf;
+	int i;
+
+	if (!(f = fopen(file, "rb"))) {
+		printf("cannot open %s\n", file);
+		exit(1);
+	}
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (!(buf = malloc(size + 1))) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	if (size && fread(buf, size, 1, f) != 1)
+		size = 0;
+	buf[size] = 0;
+	fclose(f);
+
+	stk_file = file;
+	if (!(stk_json = strstr(buf, "{\"routines\": [")))
+		stk_bad();
+	stk_take("{\"routines\": [");
+
+	while (!stk_take("]")) {
+		if (!stk_take("{\"name\":"))
+			stk_bad();
+		stk_str(name);
+		if (stk_named(name)) {
+			printf("%s is in more than one report\n", name);
+			exit(1);
+		}
+
+		if (!(r = calloc(1, sizeof(struct sroutine)))) {
+			printf("out of memory\n");
+			exit(1);
+		}
+		strcpy(r->name, name);
+		r->next = stk_table[stk_hash(name) % STK_HASH];
+		stk_table[stk_hash(name) % STK_HASH] = r;
+		if (stk_last)
+			stk_last->link = r;
+		else
+			stk_first = r;
+		stk_last = r;
+
+		if (!stk_take(",") || !stk_take("\"depth\":"))
+			stk_bad();
+		r->own = r->total = stk_num();
+
+		// calls out of the object
+		if (!stk_take(",") || !stk_take("\"externals\":") || !stk_take("{"))
+			stk_bad();
+		while (!stk_take("}")) {
+			stk_str(name);
+			if (!stk_take(":"))
+				stk_bad();
+			depth = stk_num();
+			stk_add(&r->term, &r->nterm, &r->sterm, name, 0, depth);
+			stk_take(",");
+		}
+
+		if (!stk_take(",") || !stk_take("\"flags\":") || !stk_take("["))
+			stk_bad();
+		while (!stk_take("]")) {
+			stk_str(name);
+			for (i = 0; i < 5; i++) {
+				if (!strcmp(name, stk_names[i]))
+					r->flags |= 1 << i;
+			}
+			stk_take(",");
+		}
+
+		if (!stk_take("}"))
+			stk_bad();
+		stk_take(",");
+	}
+
+	free(buf);
+}
+
+/*
+ * adds the routines a loaded routine calls in other objects onto its depth
+ * calls to routines no report has are left as they are
+ *
+ * r = routine
+ */
+void stk_link(struct sroutine *r)
+{
+	struct sroutine *callee;
+	struct scall *term, *c, *t;
+	int nterm, i, j;
+
+	if (r->done)
+		return;
+
+	r->busy = 1;
+	term = r->term;
+	nterm = r->nterm;
+	r->term = NULL;
+	r->nterm = r->sterm = 0;
+
+	for (i = 0; i < nterm; i++) {
+		c = &term[i];
+		if (!(callee = stk_named(c->name))) {
+			stk_add(&r->term, &r->nterm, &r->sterm, c->name, 0, c->depth);
+			continue;
+		}
+
+		// a loop through other objects
+		if (callee->busy) {
+			r->flags |= STK_RECURSIVE;
+			continue;
+		}
+
+		stk_link(callee);
+		r->flags |= callee->flags;
+		if (c->depth + callee->total > r->total)
+			r->total = c->depth + callee->total;
+
+		for (j = 0; j < callee->nterm; j++) {
+			t = &callee->term[j];
+			stk_add(&r->term, &r->nterm, &r->sterm, t->name, 0, c->depth + t->depth);
+		}
+	}
+	free(term);
+
+	r->busy = 0;
+	r->done = 1;
+}
+
+/*
+ * reports the final stack depth of every routine loaded from the reports
+ *
+ * json = print as a json object instead of a table
+ */
+void stk_sum(char json)
+{
+	struct sroutine *r;
+
+	for (r = stk_first; r; r = r->link) {
+		stk_link(r);
+		stk_print(r->name, r, json);
+	}
+}
+
+/*
+ * finishes the report, and throws away everything worked out for it
+ *
+ * json = print as part of a json object instead of a table
+ */
+void stk_done(char json)
+{
+	struct sroutine *r, *next;
+	int i;
+
+	if (json)
+		printf("%s]}\n", stk_count ? "" : "{\"routines\": [");
+	else if (!stk_count)
+		printf("%-10s %6s  %s\n", "routine", "depth", "externals and flags");
+
+	for (i = 0; i < STK_HASH; i++) {
+		for (r = stk_table[i]; r; r = next) {
+			next = r->next;
+			free(r->call);
+			free(r->term);
+			free(r);
+		}
+		stk_table[i] = NULL;
+	}
+
+	stk_first = stk_last = NULL;
+	stk_count = 0;
+}
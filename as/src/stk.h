@@ -0,0 +1,62 @@
+#ifndef STK_H
+#define STK_H
+
+/* includes */
+#include <stdint.h>
+
+/* defines */
+
+/* deeper than this, a loop must be pushing without popping */
+#define STK_LIMIT 0x10000
+
+/* buckets in the routine table */
+#define STK_HASH 256
+
+/* things that make a depth uncertain */
+#define STK_RECURSIVE 0x01
+#define STK_INDIRECT 0x02
+#define STK_SETSP 0x04
+#define STK_UNBOUNDED 0x08
+#define STK_LEAVES 0x10
+
+/* structs */
+
+/*
+ * a call out of a routine
+ * the name is set if the callee is not in the text segment
+ */
+struct scall {
+	char name[12];
+	uint16_t target;
+	long depth; // stack used at the call, return address included
+};
+
+/*
+ * stack use of a routine
+ */
+struct sroutine {
+	uint16_t addr;
+	char name[12]; // set if loaded from a report
+	long own; // deepest the routine goes by itself
+	long total; // deepest the routine goes with the callees it can see
+	char flags;
+	char busy;
+	char done;
+	struct scall *call;
+	int ncall;
+	int scall;
+	struct scall *term; // calls out of the text segment, with the depth before each
+	int nterm;
+	int sterm;
+	struct sroutine *next;
+	struct sroutine *link; // next routine loaded, in report order
+};
+
+/* interface functions */
+
+void stk_report(char *name, uint16_t addr, char json);
+void stk_load(char *file);
+void stk_sum(char json);
+void stk_done(char json);
+
+#endif
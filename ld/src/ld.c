@@ -5,6 +5,7 @@
  */
  
 #include "ld.h"
+#include "stat.h"
 
 #define VERSION "1.0"
 
@@ -16,6 +17,8 @@ uint8_t tmp[512];
 char flagv = 0;
 char flagr = 0;
 char flags = 0;
+char flagj = 0;
+char stats = 0; // 1 for a table, 2 for json
 
 /* tables */
 struct object *obj_table;
@@ -23,23 +26,40 @@ struct object *obj_tail;
 
 struct extrn *ext_table;
 struct extrn *ext_tail;
+struct extrn *ext_hash[EXT_HASH];
 
 struct archive *arc_table;
 struct archive *arc_tail;
 
-/* output binary stuff */
+/* output binary stuff, written under a temporary name next to the output until it is done */
 FILE *aout;
+char *oname = "a.out";
+char *otmp;
 
-/* relocation temp file */
-FILE *ltmp;
-char tname[32];
+/* map file, or NULL */
+char *mname;
 
-/* state variables */
-char newext; 
+/* binary section of the output, mapped in while it is emitted */
+uint8_t *omap;
+uint16_t osize;
 
-/* stream stuff */
-FILE *relf;
-uint16_t nreloc;
+/* every global defined by an object or archive member, hashed by name */
+struct asym *def_hash[EXT_HASH];
+struct asym *def_tail[EXT_HASH];
+
+/* check in jobs, in argument order */
+struct ldjob *job_table;
+int job_count;
+int job_size;
+
+/* objects in layout order, and the error found emitting each segment of them, text first */
+struct object **em_obj;
+char **em_err;
+int em_count;
+
+/* work handed out to the thread pool, by number */
+atomic_int pool_next;
+int pool_count;
 
 /* record keeping */
 uint16_t reloc_rec;
@@ -48,8 +68,11 @@ uint16_t extrn_rec;
 
 uint8_t extn;
 
-/* link address */
-uint16_t laddr;
+/* alignment of each output segment, as powers of 2 */
+uint8_t oalign[3];
+
+/* set if the output has a line table */
+char olines;
 
 /* arg zero */
 char *argz;
@@ -65,17 +88,11 @@ void error(char *msg, char *issue)
 	printf("error: ");
 	printf(msg, issue);
 	printf("\n");
-	// linking failed, remove a.out
+	// linking failed, remove the output
 	if (aout) {
 		fclose(aout);
-		remove(TMP_FILE);
-	}
-	// linking failed, remove relocation temp file
-	if (ltmp) {
-		fclose(ltmp);
-		remove(tname);
+		remove(otmp);
 	}
-	
 	exit(1);
 }
 
@@ -106,19 +123,6 @@ void xfclose(FILE *f)
 		error("cannot close", NULL);
 }
 
-/*
- * seek and check for success
- *
- * f = pointer to file
- * off = offset
- * w = whence for seek
- */
-void xfseek(FILE *f, off_t off, int w)
-{
-	if (fseek(f, off, w) < 0)
-		error("cannot seek", NULL);
-}
-
 /*
  * open file and check for success
  *
@@ -133,23 +137,38 @@ FILE *xfopen(char *fname, char *mode)
 	if (!(f = fopen(fname, mode))) {
 		error("cannot open %s", fname);
 	}
+	stat_opens++;
 	return f;
 }
 
 /*
- * open object file and check for success
+ * maps a whole file in, it stays mapped until the link is done
  *
- * obj = object struct to open
- * returns pointer to file
+ * fname = path to file
+ * size = where to put the size of the file
+ * returns the mapped file
  */
-FILE *xoopen(struct object *obj)
+uint8_t *xmap(char *fname, size_t *size)
 {
-	FILE *f;
+	struct stat st;
+	uint8_t *map;
+	int fd;
 	
-	f = xfopen(obj->fname, "rb");
-	xfseek(f, obj->offset, SEEK_CUR);
+	if ((fd = open(fname, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+		error("cannot open %s", fname);
 	
-	return f;
+	*size = st.st_size;
+	if (!*size)
+		error("%s not an object file", fname);
+	
+	map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		error("cannot map %s", fname);
+	close(fd);
+	
+	stat_opens++;
+	stat_read += *size;
+	return map;
 }
 
 /*
@@ -202,6 +221,17 @@ uint16_t rlend(uint8_t *b)
 	return b[0] + (b[1] << 8);
 }
 
+/*
+ * read little endian, read 4 bytes in little endian format
+ *
+ * b = pointer to first byte
+ * return value of long
+ */
+uint32_t rlend32(uint8_t *b)
+{
+	return rlend(b) + ((uint32_t) rlend(b + 2) << 16);
+}
+
 /*
  * write little endian, write 2 bytes of little endian format
  *
@@ -234,6 +264,17 @@ uint16_t cmseg(uint16_t addr, struct object *obj)
 	}
 }
 
+/*
+ * rounds an address up to an alignment
+ *
+ * addr = address
+ * align = alignment, as a power of 2
+ */
+uint16_t alignup(uint16_t addr, uint8_t align)
+{
+	return (addr + (1 << align) - 1) & ~((1 << align) - 1);
+}
+
 /*
  * adds an object to the object table
  *
@@ -250,6 +291,308 @@ void addobj(struct object *new)
 	obj_tail = new;
 }
 
+/*
+ * checks if a file is an archive or not
+ */
+char isarch(char *fname)
+{
+	FILE *f;
+	
+	f = xfopen(fname, "rb");
+	stat_read += fread(header, 1, 8, f);
+	xfclose(f);
+	
+	if (aequ((char *) header, "!<arch>\n", 8)) {
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * hashes a symbol name, 32 bit FNV-1a
+ *
+ * name = symbol name
+ */
+uint32_t shash(char *name)
+{
+	uint32_t h;
+	int i;
+	
+	h = 2166136261u;
+	for (i = 0; i < SYMBOL_NAME_SIZE-1 && name[i]; i++)
+		h = (h ^ (uint8_t) name[i]) * 16777619u;
+	
+	return h;
+}
+
+/*
+ * finds the relocation and symbol tables of an object image, making sure everything fits
+ *
+ * img = object image
+ * size = size of image
+ * rel = where to put the relocation records
+ * nrel = where to put the number of relocation records
+ * sym = where to put the symbol records
+ * nsym = where to put the number of symbol records
+ * returns 1 if the image is an object file
+ */
+char objtab(uint8_t *img, size_t size, uint8_t **rel, uint16_t *nrel, uint8_t **sym, uint16_t *nsym)
+{
+	size_t off;
+	
+	if (size < 16 || img[0x00] != 0x18 || img[0x01] != 0x0E)
+		return 0;
+	
+	// relocations come right after the binary, then symbols
+	off = rlend(&img[0x0C]);
+	if (off < 16 || off + 2 > size)
+		return 0;
+	*nrel = rlend(img + off);
+	*rel = img + off + 2;
+	
+	off += 2 + *nrel * RELOC_REC_SIZE;
+	if (off + 2 > size)
+		return 0;
+	*nsym = rlend(img + off);
+	*sym = img + off + 2;
+	
+	return off + 2 + *nsym * SYMBOL_REC_SIZE <= size;
+}
+
+/*
+ * reads the globals defined by an object, to be added to the definition table later
+ *
+ * job = job for the object
+ */
+void sindex(struct ldjob *job)
+{
+	struct asym *sym, **tail;
+	uint8_t *rel, *rec;
+	uint16_t nrel, nsym;
+	
+	if (!objtab(job->img, job->size, &rel, &nrel, &rec, &nsym)) {
+		job->err = "%s not an object file";
+		return;
+	}
+	
+	tail = &job->defs;
+	for (; nsym--; rec += SYMBOL_REC_SIZE) {
+		// externals are not defined here
+		if (rec[SYMBOL_NAME_SIZE-1] > 4)
+			continue;
+		
+		sym = (struct asym *) xalloc(sizeof(struct asym));
+		memcpy(sym->name, rec, SYMBOL_NAME_SIZE-1);
+		sym->name[SYMBOL_NAME_SIZE-1] = 0;
+		sym->type = rec[SYMBOL_NAME_SIZE-1];
+		sym->value = rlend(&rec[SYMBOL_NAME_SIZE]);
+		sym->fname = job->fname;
+		sym->member = job->member;
+		sym->hash = shash(sym->name);
+		sym->next = NULL;
+		
+		*tail = sym;
+		tail = &sym->next;
+	}
+}
+
+/*
+ * adds globals to the definition table
+ *
+ * sym = globals, in the order they were read
+ */
+void sdefine(struct asym *sym)
+{
+	struct asym *next;
+	int h;
+	
+	for (; sym; sym = next) {
+		next = sym->next;
+		sym->next = NULL;
+		stat_defs++;
+		
+		// definitions of the same name stay in the order they were read
+		h = sym->hash % EXT_HASH;
+		if (def_hash[h])
+			def_tail[h]->next = sym;
+		else
+			def_hash[h] = sym;
+		def_tail[h] = sym;
+	}
+}
+
+/*
+ * adds a check in job
+ *
+ * fname = file name
+ * member = member number if in an archive
+ * img = object image
+ * size = size of image
+ * obj = object to check in, or NULL if only its globals are needed
+ */
+void addjob(char *fname, int member, uint8_t *img, size_t size, struct object *obj)
+{
+	struct ldjob *job;
+	
+	if (job_count == job_size) {
+		job_size = job_size ? job_size * 2 : 64;
+		if (!(job_table = (struct ldjob *) realloc(job_table, sizeof(struct ldjob) * job_size)))
+			error("cannot alloc", NULL);
+	}
+	
+	job = &job_table[job_count++];
+	job->fname = fname;
+	job->member = member;
+	job->img = img;
+	job->size = size;
+	job->obj = obj;
+	job->err = NULL;
+	job->defs = NULL;
+}
+
+/*
+ * reads the member table and globals of an archive from the index ranlib wrote
+ * the index is only used if the archive has not changed size since
+ *
+ * arc = archive
+ * idx = index member data
+ * size = size of index
+ * returns true (1) if the index was used, or false (0)
+ */
+char ardef(struct archive *arc, uint8_t *idx, long size)
+{
+	struct asym *defs, *sym, **tail;
+	uint8_t *rec;
+	long nmem, nsym, i;
+	
+	if (size < ARCH_INDEX_HEAD || rlend32(idx) != arc->size)
+		return 0;
+	
+	nmem = rlend(idx + 4);
+	nsym = rlend(idx + 6);
+	if (ARCH_INDEX_HEAD + nmem * ARCH_INDEX_MEM + nsym * ARCH_INDEX_SYM > size)
+		return 0;
+	
+	// every member has to be where the index says it is
+	rec = idx + ARCH_INDEX_HEAD;
+	for (i = 0; i < nmem; i++, rec += ARCH_INDEX_MEM) {
+		if (rlend32(rec) < 68 || rlend32(rec + 4) < 16 || rlend32(rec) + rlend32(rec + 4) > arc->size)
+			return 0;
+	}
+	for (i = 0; i < nsym; i++) {
+		if (rlend(rec + i * ARCH_INDEX_SYM + SYMBOL_REC_SIZE) >= nmem)
+			return 0;
+	}
+	
+	arc->nmem = nmem;
+	arc->off = (long *) xalloc(sizeof(long) * (nmem + 1));
+	arc->len = (long *) xalloc(sizeof(long) * (nmem + 1));
+	rec = idx + ARCH_INDEX_HEAD;
+	for (i = 0; i < nmem; i++, rec += ARCH_INDEX_MEM) {
+		arc->off[i] = rlend32(rec);
+		arc->len[i] = rlend32(rec + 4);
+	}
+	
+	// the globals are in member order, the same as if every member was read
+	defs = NULL;
+	tail = &defs;
+	for (i = 0; i < nsym; i++, rec += ARCH_INDEX_SYM) {
+		sym = (struct asym *) xalloc(sizeof(struct asym));
+		memcpy(sym->name, rec, SYMBOL_NAME_SIZE-1);
+		sym->name[SYMBOL_NAME_SIZE-1] = 0;
+		sym->type = rec[SYMBOL_NAME_SIZE-1];
+		sym->value = rlend(&rec[SYMBOL_NAME_SIZE]);
+		sym->fname = arc->fname;
+		sym->member = rlend(&rec[SYMBOL_REC_SIZE]);
+		sym->hash = shash(sym->name);
+		sym->next = NULL;
+		
+		*tail = sym;
+		tail = &sym->next;
+	}
+	
+	// a job with no image, so the globals go in in argument order
+	addjob(arc->fname, 0, NULL, 0, NULL);
+	job_table[job_count - 1].defs = defs;
+	stat_indexed++;
+	
+	return 1;
+}
+
+/*
+ * maps an archive in and builds its member table
+ * if ranlib has indexed the archive, the table and globals come from the index
+ * otherwise the archive is walked once, and every member gets a job to read the globals it defines,
+ * so members do not need to be read again to resolve externals
+ *
+ * arc = archive
+ */
+void arindex(struct archive *arc)
+{
+	long start, size;
+	int nalloc;
+	
+	arc->nmem = 0;
+	arc->off = NULL;
+	arc->len = NULL;
+	nalloc = 0;
+	
+	// the archive stays mapped in until the link is done
+	arc->map = xmap(arc->fname, &arc->size);
+	
+	// member headers are 60 bytes, with the name at 0 and the size in decimal at 48
+	for (start = 8; start + 60 <= arc->size; start += size + (size % 2)) {
+		memcpy(tmp, arc->map + start, 60);
+		tmp[58] = 0;
+		size = atol((char *) tmp + 48);
+		start += 60;
+		
+		if (start + size > arc->size)
+			error("%s is damaged", arc->fname);
+		
+		// the index is not a member, it is only used if it is first
+		if (aequ((char *) tmp, ARCH_INDEX, strlen(ARCH_INDEX))) {
+			if (start == 68 && ardef(arc, arc->map + start, size))
+				return;
+			continue;
+		}
+		
+		if (size < 16)
+			error("%s is damaged", arc->fname);
+		
+		if (arc->nmem == nalloc) {
+			nalloc = nalloc ? nalloc * 2 : 64;
+			arc->off = (long *) realloc(arc->off, sizeof(long) * nalloc);
+			arc->len = (long *) realloc(arc->len, sizeof(long) * nalloc);
+			if (!arc->off || !arc->len)
+				error("out of memory", NULL);
+		}
+		arc->off[arc->nmem] = start;
+		arc->len[arc->nmem] = size;
+		
+		// read the symbol table of the member
+		addjob(arc->fname, arc->nmem, arc->map + start, size, NULL);
+		
+		arc->nmem++;
+	}
+}
+
+/*
+ * returns the archive that was added for a file
+ *
+ * fname = file name
+ */
+struct archive *getarc(char *fname)
+{
+	struct archive *arc;
+	
+	for (arc = arc_table; arc; arc = arc->next)
+		if (arc->fname == fname)
+			break;
+	
+	return arc;
+}
+
 /*
  * adds an archive to the archive table
  *
@@ -259,6 +602,11 @@ void addarc(char *fname)
 {
 	struct archive *new;
 	new = (struct archive *) xalloc(sizeof(struct archive));
+	new->fname = fname;
+	new->next = NULL;
+	
+	// read its symbols in once
+	arindex(new);
 	
 	// add it to the table
 	if (arc_table) {
@@ -269,33 +617,45 @@ void addarc(char *fname)
 	arc_tail = new;
 }
 
-
 /*
- * checks if a file is an archive or not
+ * reads the extension records after the symbol table, if there are any
+ *
+ * obj = object to fill in
+ * p = right after the symbol table
+ * returns an error message, or NULL
  */
-char isarch(char *fname)
+char *rdext(struct object *obj, uint8_t *p)
 {
-	FILE *f;
+	uint8_t *end;
+	uint16_t size;
 	
-	f = xfopen(fname, "rb");
-	fread(header, 8, 1, f);
-	xfclose(f);
+	obj->align[0] = obj->align[1] = obj->align[2] = 0;
+	obj->lines = NULL;
+	obj->nlines = 0;
 	
-	if (aequ((char *) header, "!<arch>\n", 8)) {
-		return 1;
+	if (!(obj->image[0x02] & H_EXT))
+		return NULL;
+	
+	end = obj->image + obj->size;
+	while (p + 3 <= end && p[0] != EXT_END) {
+		size = rlend(p + 1);
+		if (p + 3 + size > end)
+			return "%s not an object file";
+		
+		if (p[0] == EXT_ALIGN && size >= 3)
+			memcpy(obj->align, p + 3, 3);
+		
+		// the line table is kept where it is, it is merged once the bases are known
+		if (p[0] == EXT_LINES && !obj->lines) {
+			obj->lines = p + 3;
+			obj->nlines = size;
+		}
+		
+		// anything not understood is skipped
+		p += 3 + size;
 	}
-	return 0;
-}
-
-/*
- * skips over a relocation or symbol seg
- */
-void skipsg(FILE *f, uint8_t size)
-{
-	uint8_t b[2];
 	
-	fread(b, 2, 1, f);
-	xfseek(f, rlend(b) * size, SEEK_CUR);
+	return NULL;
 }
 
 /*
@@ -307,10 +667,12 @@ void skipsg(FILE *f, uint8_t size)
 struct extrn *getext(char *name)
 {
 	struct extrn *ext;
+	uint32_t h;
 	
 	// see if there is an external to check in
-	for (ext = ext_table; ext; ext = ext->next)
-		if (sequ(ext->name, (char *) tmp))
+	h = shash(name);
+	for (ext = ext_hash[h % EXT_HASH]; ext; ext = ext->hnext)
+		if (ext->hash == h && sequ(ext->name, name))
 			break;
 		
 	return ext;
@@ -324,48 +686,30 @@ struct extrn *getext(char *name)
  */
 struct extrn *getref(uint8_t number, struct object *obj)
 {
-	struct reference *ref;
-	
-	// look for the reference
-	for (ref = obj->head; ref; ref = ref->next)
-		if (ref->number == number)
-			return ref->ext;
-		
-	return NULL;
+	return obj->ref[number];
 }
 
 /*
  * generates an external prototype if it doesn't already exist
  *
  * obj = object source of record
- * record = pointer to record 
+ * x = external named by the record
  */
-void extprot(struct object *obj, uint8_t *record)
+void extprot(struct object *obj, struct xname *x)
 {
 	struct extrn *ext;
-	struct reference *ref;
-	uint8_t number;
-	
-	// make sure number is external
-	number = record[SYMBOL_NAME_SIZE-1];
-	if (number < 5) {
-		// record that a global symbol has been checked in
-		glob_rec++;
-		
-		return;
-	}
 	
-	// terminate symbol name and search
-	record[SYMBOL_NAME_SIZE-1] = 0;
-	ext = getext((char *) tmp);
-		
+	stat_lookups++;
+	for (ext = ext_hash[x->hash % EXT_HASH]; ext; ext = ext->hnext, stat_probes++)
+		if (ext->hash == x->hash && sequ(ext->name, x->name))
+			break;
 	
 	// new extern prototype?
 	if (!ext) {
 		// alloc new struct
 		ext = (struct extrn *) xalloc(sizeof(struct extrn));
-		memcpy(ext->name, record, SYMBOL_NAME_SIZE);
-		newext = 1;
+		memcpy(ext->name, x->name, SYMBOL_NAME_SIZE);
+		ext->hash = x->hash;
 		
 		ext->next = NULL;
 		
@@ -374,6 +718,8 @@ void extprot(struct object *obj, uint8_t *record)
 		ext->source = NULL;
 		
 		ext->number = 0;
+		ext->seen = 0;
+		stat_externs++;
 		
 		// add it to the table
 		if (ext_table) {
@@ -382,19 +728,14 @@ void extprot(struct object *obj, uint8_t *record)
 			ext_table = ext;
 		}
 		ext_tail = ext;
+		
+		ext->hnext = ext_hash[x->hash % EXT_HASH];
+		ext_hash[x->hash % EXT_HASH] = ext;
 	}
 	
-	// now attach it to the object
-	ref = (struct reference *) xalloc(sizeof(struct reference));
-	ref->ext = ext;
-	ref->number = number;
-	
-	if (obj->head) {
-		obj->tail->next = ref;
-	} else {
-		obj->head = ref;
-	}
-	obj->tail = ref;
+	// now attach it to the object, the first record with a number wins
+	if (!obj->ref[x->number])
+		obj->ref[x->number] = ext;
 }
 
 /*
@@ -404,7 +745,7 @@ void extprot(struct object *obj, uint8_t *record)
  * index = index
  * returns object if found, null if not
  */
-struct object *getobj(char *fname, uint8_t index)
+struct object *getobj(char *fname, int index)
 {
 	struct object *obj;
 	
@@ -416,111 +757,223 @@ struct object *getobj(char *fname, uint8_t index)
 }
 
 /*
- * checks in an object file and adds it to the table
+ * makes a new object, with its image mapped in
  *
  * fname = path to object file
  * index = record index if archive
- * returns pointer to new object struct
  */
-struct object *chkobj(char *fname, uint8_t index)
+struct object *objnew(char *fname, int index)
 {
-	FILE *f;
 	struct object *obj;
-	uint8_t b[2];
-	uint16_t nsym;
-	int offset;
-	
-	// do a quick check to make sure this hasn't already been checked in
-	if ((obj = getobj(fname, index)))
-		return obj;
+	struct archive *arc;
 	
 	// alloc object
 	obj = (struct object *) xalloc(sizeof(struct object));
 	obj->next = NULL;
-	obj->head = NULL;
-	obj->tail = NULL;
+	memset(obj->ref, 0, sizeof(obj->ref));
 	obj->index = index;
 	obj->fname = fname;
+	obj->xname = NULL;
+	obj->why = NULL;
 	
-	// read the header in
-	f = xfopen(fname, "rb");
-	fread(header, 8, 1, f);
+	// archive members are already mapped in, anything else is mapped now
+	if ((arc = getarc(fname))) {
+		obj->image = arc->map + arc->off[index];
+		obj->size = arc->len[index];
+	} else
+		obj->image = xmap(fname, &obj->size);
 	
-	// check if it is an archive or not
-	if (aequ((char *) header, "!<arch>\n", 8)) {
-		while (index) {
-			// skip to next record
-			xfseek(f, 48, SEEK_CUR);
-			
-			// read in file size
-			fread(tmp, 10, 1, f);
-			offset = atoi((char *) tmp);
-			
-			// if the offset is odd, make it even
-			if (offset % 2) offset++;
-			
-			// on to next record
-			// on the real system, this will need to be broken up for >32kb files
-			xfseek(f, offset + 2, SEEK_CUR);
-			index--;
-		}
-		
-		// seek at start of record
-		xfseek(f, 60, SEEK_CUR);
-		
-		// read in header
-		fread(header, 16, 1, f);
-	} else {
-		// read in the rest of the header
-		fread(header+8, 8, 1, f);
-	}
+	return obj;
+}
+
+/*
+ * parses the header and tables of an object
+ * nothing outside of the object is touched, so objects can be parsed on any thread
+ *
+ * obj = object
+ * returns an error message, or NULL
+ */
+char *objparse(struct object *obj)
+{
+	struct xname *x;
+	uint8_t *img, *rec;
 	
-	// set offset
-	obj->offset = ftell(f) - 16;
+	img = obj->image;
 	
 	// start doing checking
-	if (header[0x00] != 0x18 || header[0x01] != 0x0E)
-		error("%s not an object file", fname);
+	if (!objtab(img, obj->size, &obj->rel, &obj->nrel, &obj->sym, &obj->nsym))
+		return "%s not an object file";
 	
-	if (!(header[0x02] & 0b01))
-		error("%s not linkable", fname);
+	if (!(img[0x02] & 0b01))
+		return "%s not linkable";
 	
 	// read object text base
-	obj->org = rlend(&header[0x03]);
+	obj->org = rlend(&img[0x03]);
 	
 	// read sizes
-	obj->text_size = rlend(&header[0x0A]);
-	obj->data_size = rlend(&header[0x0C]) - obj->text_size;
-	obj->bss_size = rlend(&header[0x0E]) - obj->text_size - obj->data_size;
+	obj->text_size = rlend(&img[0x0A]);
+	obj->data_size = rlend(&img[0x0C]) - obj->text_size;
+	obj->bss_size = rlend(&img[0x0E]) - obj->text_size - obj->data_size;
 	
 	// reduce text by 16 due to the removal of header
 	obj->text_size -= 16;
 	
-	// add to object table
+	// name the externals, they are added to the external table when the object is checked in
+	obj->xname = (struct xname *) xalloc(sizeof(struct xname) * (obj->nsym + 1));
+	obj->nxname = 0;
+	obj->nglob = 0;
+	for (rec = obj->sym; rec < obj->sym + obj->nsym * SYMBOL_REC_SIZE; rec += SYMBOL_REC_SIZE) {
+		if (rec[SYMBOL_NAME_SIZE-1] < 5) {
+			obj->nglob++;
+			continue;
+		}
+		
+		x = &obj->xname[obj->nxname++];
+		memcpy(x->name, rec, SYMBOL_NAME_SIZE-1);
+		x->name[SYMBOL_NAME_SIZE-1] = 0;
+		x->number = rec[SYMBOL_NAME_SIZE-1];
+		x->hash = shash(x->name);
+	}
+	
+	// alignment comes after
+	return rdext(obj, rec);
+}
+
+/*
+ * adds a parsed object to the object table, and its externals to the external table
+ *
+ * obj = object
+ */
+void objadd(struct object *obj)
+{
+	int i;
+	
 	addobj(obj);
 	
-	// next we will dump out the external symbols
-	xfseek(f, rlend(&header[0x0C]) - 16, SEEK_CUR);
+	// record the global symbols that have been checked in
+	glob_rec += obj->nglob;
 	
-	// skip over relocations
-	skipsg(f, RELOC_REC_SIZE);
+	for (i = 0; i < obj->nxname; i++)
+		extprot(obj, &obj->xname[i]);
 	
-	// read number of symbols
-	fread(b, 2, 1, f);
-	nsym = rlend(b);
+	free(obj->xname);
+	obj->xname = NULL;
+}
+
+/*
+ * checks in an object file and adds it to the table
+ *
+ * fname = path to object file
+ * index = record index if archive
+ * returns pointer to new object struct
+ */
+struct object *chkobj(char *fname, int index)
+{
+	struct object *obj;
+	char *msg;
 	
-	// dump everything out
-	while (nsym--) {
-		fread(tmp, SYMBOL_REC_SIZE, 1, f);
-		extprot(obj, tmp);
-	}
+	// do a quick check to make sure this hasn't already been checked in
+	if ((obj = getobj(fname, index)))
+		return obj;
 	
-	// close and return
-	xfclose(f);
+	obj = objnew(fname, index);
+	if ((msg = objparse(obj)))
+		error(msg, fname);
+	objadd(obj);
 	
 	return obj;
 }
 
+/*
+ * runs numbered work on a pool of threads, one per core counting this one
+ * without -j, everything is run on this thread
+ *
+ * work = worker, takes work numbers from pool_next until it reaches pool_count
+ * count = amount of work
+ */
+void pool(void *(*work)(void *), int count)
+{
+	pthread_t *workers;
+	int i, n;
+	
+	// no more threads than there is work
+	n = 0;
+	if (flagj) {
+		n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+		if (n > count - 1)
+			n = count - 1;
+	}
+	
+	atomic_store(&pool_next, 0);
+	pool_count = count;
+	
+	workers = NULL;
+	if (n > 0) {
+		workers = (pthread_t *) xalloc(sizeof(pthread_t) * n);
+		for (i = 0; i < n; i++)
+			if (pthread_create(&workers[i], NULL, work, NULL))
+				error("cannot start thread", NULL);
+	}
+	
+	work(NULL);
+	
+	for (i = 0; i < n; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+}
+
+/*
+ * worker thread, runs check in jobs until there are none left
+ *
+ * arg = unused
+ */
+void *ldwork(void *arg)
+{
+	struct ldjob *job;
+	int i;
+	
+	while ((i = atomic_fetch_add(&pool_next, 1)) < pool_count) {
+		job = &job_table[i];
+		
+		// globals already read from an archive index
+		if (!job->img)
+			continue;
+		
+		if (job->obj && (job->err = objparse(job->obj)))
+			continue;
+		
+		sindex(job);
+	}
+	
+	return NULL;
+}
+
+/*
+ * runs every check in job, then checks the results in in argument order
+ * so the output is the same no matter how many threads there are
+ */
+void runjobs()
+{
+	struct ldjob *job;
+	int i;
+	
+	pool(ldwork, job_count);
+	
+	for (i = 0; i < job_count; i++) {
+		job = &job_table[i];
+		if (job->err)
+			error(job->err, job->fname);
+		
+		if (job->obj)
+			objadd(job->obj);
+		sdefine(job->defs);
+	}
+	
+	free(job_table);
+	job_table = NULL;
+	job_count = job_size = 0;
+}
+
 /*
  * compute the final bases for each segment in all objects
  */
@@ -528,28 +981,47 @@ void cmbase()
 {
 	struct object *curr;
 	uint16_t addr;
+	int i;
 	
 	aout = NULL;
 	
+	// the output needs the strictest alignment of any object
+	oalign[0] = oalign[1] = oalign[2] = 0;
+	for (curr = obj_table; curr; curr = curr->next) {
+		for (i = 0; i < 3; i++) {
+			if (curr->align[i] > oalign[i])
+				oalign[i] = curr->align[i];
+		}
+	}
+	
+	// line tables are merged if any object has one, unless symbols are squashed
+	olines = 0;
+	for (curr = obj_table; curr; curr = curr->next) {
+		if (curr->lines && !flags)
+			olines = 1;
+	}
+	
 	// addr starts at 16, right after the header
 	addr = 16;
 	
-	// compute text bases
+	// compute text bases, text is aligned from where the header would be
 	for (curr = obj_table; curr; curr = curr->next) {
-		curr->text_base = addr;
-		addr += curr->text_size;
+		curr->text_base = alignup(addr - 16, curr->align[0]) + 16;
+		addr = curr->text_base + curr->text_size;
 	}
 	
-	// compute data bases
+	// compute data bases, the output data segment must start aligned too
+	addr = alignup(addr, oalign[1]);
 	for (curr = obj_table; curr; curr = curr->next) {
-		curr->data_base = addr;
-		addr += curr->data_size;
+		curr->data_base = alignup(addr, curr->align[1]);
+		addr = curr->data_base + curr->data_size;
 	}
 	
 	// compute bss bases
+	addr = alignup(addr, oalign[2]);
 	for (curr = obj_table; curr; curr = curr->next) {
-		curr->bss_base = addr;
-		addr += curr->bss_size;
+		curr->bss_base = alignup(addr, curr->align[2]);
+		addr = curr->bss_base + curr->bss_size;
 	}
 }
 
@@ -569,6 +1041,9 @@ void emhead()
 		header[0x02] = 0b11;
 	}
 	
+	if (oalign[0] || oalign[1] || oalign[2] || olines)
+		header[0x02] |= H_EXT;
+	
 	// text origin always at 0
 	wlend(&header[0x03], 0x0000);
 	
@@ -580,11 +1055,11 @@ void emhead()
 	// text entry is 0
 	wlend(&header[0x08], 0x0000);
 	
-	// text top
-	wlend(&header[0x0A], obj_tail->text_base + obj_tail->text_size);
+	// text top, including any padding before the data
+	wlend(&header[0x0A], obj_table->data_base);
 	
-	// data top
-	wlend(&header[0x0C], obj_tail->data_base + obj_tail->data_size);
+	// data top, including any padding before the bss
+	wlend(&header[0x0C], obj_table->bss_base);
 	
 	// bss top
 	wlend(&header[0x0E], obj_tail->bss_base + obj_tail->bss_size);
@@ -594,125 +1069,162 @@ void emhead()
 }
 
 /*
- * clears the symbol table before a symdump cycle
- * used in making sure there aren't any duplicate symbols linked
+ * resolves an external from the definition table, checking in whatever defines it
+ * an external defined in more than one place is an error, even if one is never checked in
+ *
+ * ext = external
+ */
+void sresolve(struct extrn *ext)
+{
+	struct asym *sym, *def;
+	
+	stat_resolved++;
+	stat_dlookups++;
+	
+	def = NULL;
+	for (sym = def_hash[ext->hash % EXT_HASH]; sym; sym = sym->next, stat_dprobes++) {
+		if (sym->hash != ext->hash || !sequ(sym->name, ext->name))
+			continue;
+		
+		if (def)
+			error("duplicate symbol %s", ext->name);
+		def = sym;
+	}
+	
+	if (!def)
+		return;
+	
+	ext->value = def->value;
+	ext->type = def->type;
+	ext->source = chkobj(def->fname, def->member);
+	
+	// the first external a member resolves is why it was checked in
+	if (!ext->source->why && getarc(def->fname)) {
+		ext->source->why = ext;
+		stat_members++;
+	}
+}
+
+/*
+ * puts the externals an object names onto the end of the external table, if they are not there yet
+ *
+ * obj = object
  */
-void sclear()
+void sseen(struct object *obj)
 {
 	struct extrn *ext;
+	uint8_t *rec;
 	
-	for (ext = ext_table; ext; ext = ext->next)
-		ext->source = NULL;
+	for (rec = obj->sym; rec < obj->sym + obj->nsym * SYMBOL_REC_SIZE; rec += SYMBOL_REC_SIZE) {
+		if (rec[SYMBOL_NAME_SIZE-1] < 5)
+			continue;
+		
+		memcpy(tmp, rec, SYMBOL_NAME_SIZE-1);
+		tmp[SYMBOL_NAME_SIZE-1] = 0;
+		if (!(ext = getext((char *) tmp)) || ext->seen)
+			continue;
+		
+		ext->seen = 1;
+		ext->next = NULL;
+		if (ext_table) {
+			ext_tail->next = ext;
+		} else {
+			ext_table = ext;
+		}
+		ext_tail = ext;
+	}
 }
 
 /*
- * dumps out all the symbols in an archive or object file
- *
- * fname = file name
- * index = index of archive
+ * checks if an object defines an external named by an object that has been put in order
  *
- * returns 1 if has next object in archive
+ * obj = object
+ * returns true (1) or false (0)
  */
-char sdump(char *fname, uint8_t index)
+char sneeded(struct object *obj)
 {
-	uint16_t nsym;
-	uint8_t b[2], type, cnt;
-	FILE *f;
 	struct extrn *ext;
-	int offset;
-	char ret;
-
-	// read the header in
-	f = xfopen(fname, "rb");
-	fread(header, 8, 1, f);
+	uint8_t *rec;
 	
-	// check if it is an archive or not
-	ret = 1;
-	if (aequ((char *) header, "!<arch>\n", 8)) {
-		cnt = index;
-		while (cnt) {
-			// skip to next record
-			xfseek(f, 48, SEEK_CUR);
-			
-			// read in file size
-			fread(tmp, 10, 1, f);
-			offset = atoi((char *) tmp);
-			
-			// if the offset is odd, make it even
-			if (offset % 2) offset++;
-
-			// on to next record
-			// on the real system, this will need to be broken up for >32kb files
-			xfseek(f, offset + 2, SEEK_CUR);
-			cnt--;
-		}
-		
-		// ensure that there is a record here
-		if (fread(tmp, 16, 1, f) != 1) {
-			xfclose(f);
-			return 0;
-		}
-		tmp[15] = 0;
-		
-		// seek at start of record
-		xfseek(f, 44, SEEK_CUR);
-		
-		// read in header
-		fread(header, 16, 1, f);
-	} else {
-		// no more records to read after this
-		ret = 0;
+	for (rec = obj->sym; rec < obj->sym + obj->nsym * SYMBOL_REC_SIZE; rec += SYMBOL_REC_SIZE) {
+		if (rec[SYMBOL_NAME_SIZE-1] > 4)
+			continue;
 		
-		// read in the rest of the header
-		fread(header+8, 8, 1, f);
+		memcpy(tmp, rec, SYMBOL_NAME_SIZE-1);
+		tmp[SYMBOL_NAME_SIZE-1] = 0;
+		if ((ext = getext((char *) tmp)) && ext->seen)
+			return 1;
 	}
 	
-	// start doing checking
-	if (header[0x00] != 0x18 || header[0x01] != 0x0E)
-		error("%s not an object file", fname);
-	
-	// now  we will dump out the internal symbols
-	xfseek(f, rlend(&header[0x0C]) - 16, SEEK_CUR);
-	
-	// read the number of symbols
-	skipsg(f, RELOC_REC_SIZE);
-	fread(b, 2, 1, f);
-	nsym = rlend(b);
-	
-	while (nsym--) {
-		// read name
-		fread(tmp, SYMBOL_NAME_SIZE-1, 1, f);
-		tmp[SYMBOL_NAME_SIZE-1] = 0;
-		
-		// read type and value
-		fread(&type, 1, 1, f);
-		fread(b, 2, 1, f);
-		
-		// if the type is external, skip it for now
-		if (type > 4)
-			continue;
-
-		ext = getext((char *) tmp);
-		
-		// if an external can't be found, move on to the next symbol
-		if (!ext)
-			continue;
+	return 0;
+}
 
-		// make sure this symbol hasn't been checked in already
-		if (ext->source)
-			error("duplicate symbol %s", (char *) tmp);
-		
-		// update it
-		ext->value = rlend(b);
-		ext->type = type;
+/*
+ * puts the archive members that were checked in, and the externals, in the order archives have always been linked in:
+ * every archive is swept over in order, and a member goes in as soon as it defines an external named by something before it
+ * the sweeps go on until nothing more goes in
+ */
+void arorder()
+{
+	struct object *obj, *next, **mem;
+	struct archive *arc;
+	long base, nmem;
+	int placed, i;
+	
+	// arguments stay where they are, members are taken out
+	nmem = 0;
+	for (arc = arc_table; arc; arc = arc->next)
+		nmem += arc->nmem;
+	mem = (struct object **) xalloc(sizeof(struct object *) * (nmem + 1));
+	memset(mem, 0, sizeof(struct object *) * (nmem + 1));
+	
+	obj = obj_table;
+	obj_table = obj_tail = NULL;
+	for (; obj; obj = next) {
+		next = obj->next;
+		obj->next = NULL;
 		
-		// set the source, checking it in if required
-		ext->source = chkobj(fname, index);;
+		if (getarc(obj->fname)) {
+			base = 0;
+			for (arc = arc_table; arc->fname != obj->fname; arc = arc->next)
+				base += arc->nmem;
+			mem[base + obj->index] = obj;
+		} else
+			addobj(obj);
 	}
 	
-	xfclose(f);
+	// the external table is built up again in the order externals are first named
+	// every external is named by some object, so none are lost
+	ext_table = ext_tail = NULL;
+	for (obj = obj_table; obj; obj = obj->next)
+		sseen(obj);
+	
+	do {
+		placed = 0;
+		base = 0;
+		for (arc = arc_table; arc; arc = arc->next) {
+			for (i = 0; i < arc->nmem; i++) {
+				obj = mem[base + i];
+				if (!obj || !sneeded(obj))
+					continue;
+				
+				addobj(obj);
+				sseen(obj);
+				mem[base + i] = NULL;
+				placed++;
+			}
+			base += arc->nmem;
+		}
+	} while (placed);
 	
-	return ret;
+	// anything left over goes on the end
+	for (i = 0; i < nmem; i++) {
+		if (mem[i]) {
+			addobj(mem[i]);
+			sseen(mem[i]);
+		}
+	}
+	free(mem);
 }
 
 /*
@@ -787,108 +1299,59 @@ void sfix()
 void scopy()
 {
 	struct object *obj;
-	uint16_t nsym, value;
-	FILE *f;
+	uint8_t *rec;
+	uint16_t value;
 	
 	for (obj = obj_table; obj; obj = obj->next) {
-		f = xoopen(obj);
-		
-		// jump to symbol table
-		fread(header, 16, 1, f);
-		xfseek(f, rlend(&header[0x0C]) - 16, SEEK_CUR);
-		skipsg(f, RELOC_REC_SIZE);
-		
-		fread(tmp, 2, 1, f);
-		nsym = rlend(tmp);
-		
-		while (nsym--) {
-			// read in symbol record
-			fread(tmp, SYMBOL_REC_SIZE, 1, f);
-			
+		for (rec = obj->sym; rec < obj->sym + obj->nsym * SYMBOL_REC_SIZE; rec += SYMBOL_REC_SIZE) {
 			// skip external symbols
-			if (tmp[SYMBOL_REC_SIZE-3] > 4)
+			if (rec[SYMBOL_REC_SIZE-3] > 4)
 				continue;
 			
-			value = rlend(&tmp[SYMBOL_REC_SIZE-2]);
-			
 			// relocate value to proper place
+			memcpy(tmp, rec, SYMBOL_REC_SIZE);
+			value = rlend(&tmp[SYMBOL_REC_SIZE-2]);
 			value = sreloc(value, tmp[SYMBOL_REC_SIZE-3], obj);
 			
 			// write it out
 			wlend(&tmp[SYMBOL_REC_SIZE-2], value);
 			fwrite(tmp, SYMBOL_REC_SIZE, 1, aout);
 		}
-		
-		xfclose(f);
 	}
-	
-	// copy all undefined externals back into the binary
-	
-}
-
-/*
- * closes up the currectly open stream
- */
-void sclose()
-{
-	xfclose(relf);
 }
 
 /*
- * opens a streams to read relocation data
+ * adds a relocation record for the output
  *
- * obj = object to open
+ * obj = object being emitted
+ * seg = segment being emitted
+ * type = relocation type
+ * addr = address in the output
  */
-void sopen(struct object *obj)
+void emrec(struct object *obj, uint8_t seg, uint8_t type, uint16_t addr)
 {
-	// open objects
-	relf = xoopen(obj);
+	uint8_t *rec;
 	
-	// first one jumps to relocation table
-	fread(header, 16, 1, relf);
-	xfseek(relf, rlend(&header[0x0C]) - 16, SEEK_CUR);
-	
-	// now we read in the number of records for each
-	fread(tmp, 2, 1, relf);
-	nreloc = rlend(tmp);
-}
-
-/*
- * reads the next value in the stream into a tval
- *
- * out = pointer to output tval
- */
-void snext(struct tval *out)
-{
-	if (nreloc) {
-		nreloc--;
-		fread(tmp, 3, 1, relf);
-		out->type = tmp[0];
-		out->value = rlend(tmp + 1);
-	} else {
-		out->value = 0;
-		out->type = 0;
-	}
-	
-
+	rec = obj->orel[seg] + obj->norel[seg]++ * RELOC_REC_SIZE;
+	rec[0] = type;
+	wlend(rec + 1, addr);
 }
 
 /*
- * emits a binary segment
+ * emits a binary segment into the mapped output, at the base of the segment
+ * relocation records for the output are kept with the object, to be written out in order later
+ * only the object and its part of the output are written, so segments can be emitted on any thread
  *
  * obj = object to emit
  * seg = segment to emit (0 = text, 1 = data)
+ * returns an error message, or NULL
  */
-void emseg(struct object *obj, uint8_t seg)
+char *emseg(struct object *obj, uint8_t seg)
 {
-	FILE *bin;
-	struct tval next;
 	struct extrn *ext;
-	uint16_t skip, last, chunk, left, value;
-	
-	// open up the object binary and stream
-	bin = xoopen(obj);
-	sopen(obj);
+	uint8_t *rec, *end;
+	uint16_t skip, last, chunk, left, value, addr, laddr;
+	long nrel;
 	
 	// first we figure out how much information to skip
 	// header always gets skipped
@@ -901,22 +1364,36 @@ void emseg(struct object *obj, uint8_t seg)
 		left = obj->text_size;
 	}
 	
-	// seek binary, and scan through stream
-	xfseek(bin, skip, SEEK_CUR);
-	for (snext(&next); next.value && next.value < skip; snext(&next));
+	if (skip + left > obj->size)
+		return "%s not an object file";
+	
+	// everything before the base of the segment is already zero
+	laddr = seg ? obj->data_base : obj->text_base;
+	if (laddr + left > osize)
+		return "output too large";
+	
+	// there can be no more relocations than the object has
+	obj->orel[seg] = (uint8_t *) xalloc(obj->nrel * RELOC_REC_SIZE + 1);
+	obj->norel[seg] = 0;
+	
+	// scan through the relocations
+	rec = obj->rel;
+	end = obj->rel + obj->nrel * RELOC_REC_SIZE;
+	for (; rec < end && rlend(rec + 1) < skip; rec += RELOC_REC_SIZE);
 	
 	last = skip;
-	// read out the binary
+	nrel = 0;
+	// copy out the binary, straight from the image
 	while (left) {
+		addr = rec < end ? rlend(rec + 1) : 0;
 		
-		// figure out how many bytes to read this chunk
-		if (next.value) {
+		// figure out how many bytes to copy this chunk
+		if (addr) {
 			// sanity check
-			if (last > next.value) {
-				error("backwards relocation", NULL);
-			}
+			if (last > addr)
+				return "backwards relocation";
 			
-			chunk =  next.value - last;
+			chunk = addr - last;
 		} else 
 			chunk = left;
 		
@@ -924,101 +1401,431 @@ void emseg(struct object *obj, uint8_t seg)
 		if (chunk > left)
 			chunk = left;
 		
-		// make sure we aren't reading more than 512 bytes
-		if (chunk > 512)
-			chunk = 512;
-		
 		// transfer to binary
-		fread(tmp, chunk, 1, bin);
-		fwrite(tmp, chunk, 1, aout);
+		memcpy(omap + laddr, obj->image + last, chunk);
 		left -= chunk;
 		last += chunk;
 		laddr += chunk;
 		
 		// see if we should do a relocation
-		if (next.value == last && left) {
+		if (addr == last && left) {
 			if (left < 2)
-				error("cannot relocate byte", NULL);
+				return "cannot relocate byte";
 			
-			// read 2 bytes
-			fread(tmp, 2, 1, bin);
-			value = rlend(tmp);
+			value = rlend(obj->image + last);
 			
-			if (next.type > 0 && next.type < 4) {
+			if (rec[0] > 0 && rec[0] < 4) {
 				// relocate to segment
-				value = sreloc(value, next.type, obj);
-				
-				reloc_rec++;
-				tmp[0] = next.type;
-				wlend(tmp+1, laddr);
-				fwrite(tmp, RELOC_REC_SIZE, 1, ltmp);
+				value = sreloc(value, rec[0], obj);
+				emrec(obj, seg, rec[0], laddr);
 			} else {
 				// relocate to external
-				ext = getref(next.type, obj);
+				ext = getref(rec[0], obj);
 				if (!ext)
-					error("invalid external number", NULL);
+					return "invalid external number";
 				
 				// check to see if this is a valid external or not
 				if (ext->number) {
 					// its undefined, leave the value unchanged and record this in relocations
-					reloc_rec++;
-					tmp[0] = ext->number;
-					wlend(tmp+1, laddr);
-					fwrite(tmp, RELOC_REC_SIZE, 1, ltmp);
+					emrec(obj, seg, ext->number, laddr);
 				} else {
 					// its defined, patch in external symbol
 					value += ext->value;
 					
-					if (ext->type > 0 && ext->type < 4) {
-						reloc_rec++;
-						tmp[0] = ext->type;
-						wlend(tmp+1, laddr);
-						fwrite(tmp, RELOC_REC_SIZE, 1, ltmp);
-					}
+					if (ext->type > 0 && ext->type < 4)
+						emrec(obj, seg, ext->type, laddr);
 				}
 			}
 			
 			// write the binary
-			wlend(tmp, value);
-			fwrite(tmp, 2, 1, aout);
+			wlend(omap + laddr, value);
 			
 			// update trackers
 			left -= 2;
 			last += 2;
 			laddr += 2;
 			
-			// grab next
-			snext(&next);
+			// on to the next relocation
+			rec += RELOC_REC_SIZE;
+			nrel++;
+		}
+	}
+	
+	atomic_fetch_add(&stat_relocs, nrel);
+	return NULL;
+}
+
+/*
+ * worker thread, emits segments until there are none left
+ *
+ * arg = unused
+ */
+void *emwork(void *arg)
+{
+	int i;
+	
+	while ((i = atomic_fetch_add(&pool_next, 1)) < pool_count)
+		em_err[i] = emseg(em_obj[i % em_count], i / em_count);
+	
+	return NULL;
+}
+
+/*
+ * reads a number written 7 bits at a time, lowest first
+ *
+ * b = buffer
+ * i = index into buffer, moved past the number
+ */
+uint32_t rdvlq(uint8_t *b, int *i)
+{
+	uint32_t v;
+	int shift;
+	
+	v = 0;
+	shift = 0;
+	do {
+		v |= (uint32_t) (b[*i] & 0x7F) << shift;
+		shift += 7;
+	} while (b[(*i)++] & 0x80);
+	
+	return v;
+}
+
+/*
+ * writes a number 7 bits at a time, lowest first
+ *
+ * b = buffer
+ * n = index into buffer, moved past the number
+ * v = number
+ */
+void wrvlq(uint8_t *b, int *n, uint32_t v)
+{
+	while (v > 0x7F) {
+		b[(*n)++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	b[(*n)++] = v;
+}
+
+/*
+ * adds a row to the output line table
+ *
+ * b = buffer
+ * n = index into buffer, moved past the row
+ * state = address, file and line of the last row, updated
+ * addr = address
+ * file = file index
+ * line = line number
+ */
+void wrrow(uint8_t *b, int *n, long *state, uint16_t addr, uint8_t file, long line)
+{
+	uint32_t zz;
+	
+	// negative line deltas are odd, positive ones even
+	zz = line < state[2] ? (state[2] - line) * 2 - 1 : (line - state[2]) * 2;
+	
+	wrvlq(b, n, (uint16_t) (addr - state[0]));
+	wrvlq(b, n, (zz << 1) | (file != state[1]));
+	if (file != state[1])
+		b[(*n)++] = file;
+	
+	state[0] = addr;
+	state[1] = file;
+	state[2] = line;
+}
+
+/*
+ * merges the line tables of all objects, in the order their text is emitted
+ * text from objects without a line table gets a row with no source line
+ */
+void emlines()
+{
+	struct object *obj;
+	uint8_t *out, *lt, map[256];
+	char *names[256];
+	int nnames, size, n, i, j, end, nfile;
+	long in[3], state[3];
+	uint32_t v;
+	
+	// work out how big the merged table could be
+	size = 1;
+	for (obj = obj_table; obj; obj = obj->next)
+		size += obj->nlines * 5 + 16;
+	out = (uint8_t *) xalloc(size);
+	
+	// merge file names, the same name only goes in once
+	nnames = 0;
+	for (obj = obj_table; obj; obj = obj->next) {
+		if (!obj->lines)
+			continue;
+		
+		lt = obj->lines;
+		nfile = lt[0];
+		for (i = 1, j = 0; j < nfile; j++) {
+			for (map[j] = 0; map[j] < nnames && strcmp(names[map[j]], (char *) lt + i); map[j]++);
+			if (map[j] == nnames) {
+				if (nnames == LINE_NONE)
+					error("too many source files in line tables", NULL);
+				names[nnames++] = (char *) lt + i;
+			}
+			i += strlen((char *) lt + i) + 1;
+		}
+	}
+	
+	n = 0;
+	out[n++] = nnames;
+	for (i = 0; i < nnames; i++) {
+		strcpy((char *) out + n, names[i]);
+		n += strlen(names[i]) + 1;
+	}
+	
+	// rows are relocated into the output, which starts from nothing again
+	state[0] = state[1] = state[2] = 0;
+	for (obj = obj_table; obj; obj = obj->next) {
+		if (!obj->lines) {
+			if (obj->text_size)
+				wrrow(out, &n, state, obj->text_base, LINE_NONE, 0);
+			continue;
+		}
+		
+		// file names were already merged, map them again
+		lt = obj->lines;
+		nfile = lt[0];
+		for (i = 1, j = 0; j < nfile; j++) {
+			for (map[j] = 0; strcmp(names[map[j]], (char *) lt + i); map[j]++);
+			i += strlen((char *) lt + i) + 1;
+		}
+		
+		in[0] = in[1] = in[2] = 0;
+		end = obj->nlines;
+		while (i < end) {
+			in[0] = (uint16_t) (in[0] + rdvlq(lt, &i));
+			v = rdvlq(lt, &i);
+			if (v & 1)
+				in[1] = lt[i++];
+			v >>= 1;
+			in[2] += v & 1 ? -(long) ((v + 1) >> 1) : (long) (v >> 1);
+			
+			wrrow(out, &n, state, cmseg(in[0], obj), in[1] < nfile ? map[in[1]] : LINE_NONE, in[2]);
 		}
 	}
 	
+	if (n > 0xFFFF)
+		error("line table too large", NULL);
+	
+	tmp[0] = EXT_LINES;
+	wlend(tmp + 1, n);
+	fwrite(tmp, 3, 1, aout);
+	fwrite(out, n, 1, aout);
 	
-	// close everything
-	xfclose(bin);
-	sclose();
+	free(out);
 }
 
 /*
  * emits the binary section of the object file
+ * the output is sized and mapped in, then every segment is relocated straight into its place
  */
 void embin()
 {
-	uint8_t seg;
 	struct object *obj;
+	int i;
+	
+	// everything up to the bss, the header is already written
+	osize = obj_table->bss_base;
+	fflush(aout);
+	if (ftruncate(fileno(aout), osize) < 0)
+		error("cannot write %s", oname);
+	omap = mmap(NULL, osize, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(aout), 0);
+	if (omap == MAP_FAILED)
+		error("cannot map %s", oname);
+	
+	// objects will be emitted in order
+	em_count = 0;
+	for (obj = obj_table; obj; obj = obj->next)
+		em_count++;
+	em_obj = (struct object **) xalloc(sizeof(struct object *) * em_count);
+	em_err = (char **) xalloc(sizeof(char *) * em_count * 2);
+	for (i = 0, obj = obj_table; obj; obj = obj->next)
+		em_obj[i++] = obj;
+	
+	// every segment is emitted at once, text first
+	pool(emwork, em_count * 2);
+	
+	// errors are reported in the order the segments are laid out
+	for (i = 0; i < em_count * 2; i++)
+		if (em_err[i])
+			error(em_err[i], em_obj[i % em_count]->fname);
+	
+	if (munmap(omap, osize) < 0)
+		error("cannot write %s", oname);
+	omap = NULL;
+	fseek(aout, osize, SEEK_SET);
+	stat_seeks++;
 	
 	// count number of relocations in final binary
 	reloc_rec = 0;
+	for (i = 0; i < em_count * 2; i++)
+		reloc_rec += em_obj[i % em_count]->norel[i / em_count];
+	
+	free(em_err);
+}
+
+/*
+ * emits the relocation records of each segment, in the order the segments were laid out
+ */
+void emrel()
+{
+	struct object *obj;
+	int i;
+	
+	for (i = 0; i < em_count * 2; i++) {
+		obj = em_obj[i % em_count];
+		fwrite(obj->orel[i / em_count], RELOC_REC_SIZE, obj->norel[i / em_count], aout);
+		free(obj->orel[i / em_count]);
+	}
+	
+	free(em_obj);
+}
+
+/*
+ * returns the name of a segment type
+ *
+ * type = symbol type
+ */
+char *segname(uint8_t type)
+{
+	switch (type) {
+		case 0:
+			return "undef";
+		
+		case 1:
+			return "text";
+			
+		case 2:
+			return "data";
+			
+		case 3:
+			return "bss";
+			
+		default:
+			return "abs";
+	}
+}
+
+/*
+ * writes the name of an object, archive members are written as archive(member)
+ *
+ * obj = object
+ * buf = where to write the name
+ * size = size of buf
+ */
+void objname(struct object *obj, char *buf, size_t size)
+{
+	struct archive *arc;
+	uint8_t *hdr;
+	int n;
+	
+	if (!(arc = getarc(obj->fname))) {
+		snprintf(buf, size, "%s", obj->fname);
+		return;
+	}
+	
+	// member names are the first 16 bytes of the header, padded with spaces and maybe ending with a slash
+	hdr = arc->map + arc->off[obj->index] - 60;
+	for (n = 16; n && (hdr[n-1] == ' ' || hdr[n-1] == '/'); n--);
+	
+	if (n)
+		snprintf(buf, size, "%s(%.*s)", arc->fname, n, (char *) hdr);
+	else
+		snprintf(buf, size, "%s(%d)", arc->fname, obj->index);
+}
+
+/*
+ * compares map symbols by address, then layout order
+ */
+int msymcmp(const void *a, const void *b)
+{
+	const struct msym *x = a, *y = b;
+	
+	if (x->value != y->value)
+		return x->value < y->value ? -1 : 1;
+	return x->order - y->order;
+}
+
+/*
+ * writes out the map file
+ * objects in layout order with their bases, global symbols by address, and what each archive put in
+ */
+void emmap()
+{
+	FILE *f;
+	struct object *obj;
+	struct archive *arc;
+	struct msym *syms;
+	uint8_t *rec;
+	char name[256];
+	int n, i;
+	long size[3];
+	
+	f = xfopen(mname, "w");
+	
+	// objects, and the external that pulled each member in
+	fprintf(f, "objects:\n");
+	fprintf(f, "%-10s %-10s %-10s %-24s %s\n", "text", "data", "bss", "object", "reason");
+	n = 0;
+	for (obj = obj_table; obj; obj = obj->next) {
+		objname(obj, name, sizeof(name));
+		fprintf(f, "%04x:%04x  %04x:%04x  %04x:%04x  %-24s %s\n", obj->text_base, obj->text_size, obj->data_base, obj->data_size, obj->bss_base, obj->bss_size, name, obj->why ? obj->why->name : "-");
+		n += obj->nglob;
+	}
 	
-	// relocation starts at 0x10
-	laddr = 0x10;
+	// globals, the same ones written to the output symbol table
+	syms = (struct msym *) xalloc(sizeof(struct msym) * (n + 1));
+	n = 0;
+	for (obj = obj_table; obj; obj = obj->next) {
+		for (rec = obj->sym; rec < obj->sym + obj->nsym * SYMBOL_REC_SIZE; rec += SYMBOL_REC_SIZE) {
+			if (rec[SYMBOL_REC_SIZE-3] > 4)
+				continue;
+			
+			memcpy(syms[n].name, rec, SYMBOL_NAME_SIZE-1);
+			syms[n].name[SYMBOL_NAME_SIZE-1] = 0;
+			syms[n].type = rec[SYMBOL_REC_SIZE-3];
+			syms[n].value = sreloc(rlend(&rec[SYMBOL_REC_SIZE-2]), syms[n].type, obj);
+			syms[n].obj = obj;
+			syms[n].order = n;
+			n++;
+		}
+	}
+	qsort(syms, n, sizeof(struct msym), msymcmp);
 	
-	// first the text segment is emitted, then data
-	for (seg = 0; seg < 2; seg++) {
-		// objects will be emitted in order
+	fprintf(f, "\nsymbols:\n");
+	fprintf(f, "%-5s %-5s %-8s %s\n", "addr", "seg", "name", "object");
+	for (i = 0; i < n; i++) {
+		objname(syms[i].obj, name, sizeof(name));
+		fprintf(f, "%04x  %-5s %-8s %s\n", syms[i].value, segname(syms[i].type), syms[i].name, name);
+	}
+	free(syms);
+	
+	// what each archive added to the output
+	fprintf(f, "\narchives:\n");
+	fprintf(f, "%-5s %-5s %-5s %-7s %s\n", "text", "data", "bss", "members", "archive");
+	for (arc = arc_table; arc; arc = arc->next) {
+		size[0] = size[1] = size[2] = 0;
+		n = 0;
 		for (obj = obj_table; obj; obj = obj->next) {
-			emseg(obj, seg);
+			if (obj->fname != arc->fname)
+				continue;
+			
+			size[0] += obj->text_size;
+			size[1] += obj->data_size;
+			size[2] += obj->bss_size;
+			n++;
 		}
+		fprintf(f, "%04lx  %04lx  %04lx  %-7d %s\n", size[0], size[1], size[2], n, arc->fname);
 	}
+	
+	stat_written += ftell(f);
+	xfclose(f);
 }
 
 /*
@@ -1026,21 +1833,26 @@ void embin()
  */
 void usage()
 {
-	printf("usage: %s [-vs] [-r] object.o ...\n", argz);
+	printf("usage: %s [-vsj] [-r] [-o output] [-M map] [--stats[=json]] object.o ...\n", argz);
 	exit(1);
 }
 
 int main(int argc, char *argv[])
 {
-	int i, o;
+	int i, o, n;
 	struct object *obj;
 	struct extrn *ext;
 	
 	argz = argv[0];
 	
-	// flag switch
+	// flag switch, object arguments are moved down in order over the flags
+	n = 1;
 	for (i = 1; i < argc; i++) {
-		if (argv[i][0] == '-') {
+		if (!strcmp(argv[i], "--stats")) {
+			stats = 1;
+		} else if (!strcmp(argv[i], "--stats=json")) {
+			stats = 2;
+		} else if (argv[i][0] == '-') {
 			o = 1;
 			while (argv[i][o]) {
 				switch (argv[i][o]) {
@@ -1057,21 +1869,37 @@ int main(int argc, char *argv[])
 						flags++;
 						break;
 						
+					case 'j': // parse objects on a pool of threads
+						flagj++;
+						break;
+						
+					case 'o': // output file, the next argument
+						if (++i == argc)
+							usage();
+						oname = argv[i];
+						goto next_arg;
+						
+					case 'M': // map file, the next argument
+						if (++i == argc)
+							usage();
+						mname = argv[i];
+						goto next_arg;
+						
 					default:
 						usage();
 						break;
 				}
 				o++;
 			}
+		} else {
+			argv[n++] = argv[i];
 		}
+next_arg:;
 	}
+	argc = n;
 	
 	// check to see if there are any actual arguments
-	o = 1;
-	for (i = 1; i < argc; i++)
-		if (argv[i][0] != '-')
-			o = 0;
-	if (o)
+	if (argc == 1)
 		usage();
 	
 	// check for invalid configurations
@@ -1083,39 +1911,33 @@ int main(int argc, char *argv[])
 	if (flagv)
 		printf("TRASM link editor v%s\n", VERSION);
 	
-	// first we set up the external tables
-	newext = 0;
-	
 	// keep track of all globals in checked in objects
 	glob_rec = 0;
+	stat_reset();
 	
-	// check in all object files (but not archives)
+	// check in all object files (but not archives), and read in what everything defines
 	for (i = 1; i < argc; i++) {
-		if (argv[i][0] != '-') {
-			if (isarch(argv[i])) {
-				// add it to the archive table for later
-				addarc(argv[i]);
-			} else {
-				chkobj(argv[i], 0);
-			}
+		if (isarch(argv[i])) {
+			// add it to the archive table for later
+			addarc(argv[i]);
+		} else {
+			obj = objnew(argv[i], 0);
+			addjob(argv[i], 0, obj->image, obj->size, obj);
 		}
 	}
+	runjobs();
+	stat_mark(STAT_CHECKIN);
 	
 	// reset record keeping
 	extrn_rec = 0;
 	
-	// dump symbols
-	while (newext) {
-		// if we link in any new externals, we run the loop again
-		sclear();		
-		newext = 0;
-		for (i = 1; i < argc; i++) {
-			if (argv[i][0] != '-') {
-				o = 0;
-				while (sdump(argv[i], o++));
-			}
-		}
-	}
+	// resolve symbols, externals brought in by checked in members go on the end of the table
+	for (ext = ext_table; ext; ext = ext->next)
+		sresolve(ext);
+	
+	// but they are laid out in the order they always have been
+	if (arc_table)
+		arorder();
 	
 	// check for undefined external 
 	extn = 5;
@@ -1138,6 +1960,7 @@ int main(int argc, char *argv[])
 	}
 	if (extn != 5 && !flagr)
 		error("undefined externals", NULL);
+	stat_mark(STAT_RESOLVE);
 	
 	// calculate bases / fix symbols
 	cmbase();
@@ -1155,56 +1978,32 @@ int main(int argc, char *argv[])
 	if (flagv) {
 		printf("symbol name/value/segment\n");
 		for (ext = ext_table; ext; ext = ext->next) {
-			printf("	name: %s, value: %04x ", ext->name, ext->value);
-			switch(ext->type) {
-				case 0:
-					printf("undef\n");
-					break;
-				
-				case 1:
-					printf("text\n");
-					break;
-					
-				case 2:
-					printf("data\n");
-					break;
-					
-				case 3:
-					printf("bss\n");
-					break;
-					
-				default:
-					printf("abs\n");
-					break;
-			}
+			printf("	name: %s, value: %04x %s\n", ext->name, ext->value, segname(ext->type));
 		}
 	}
 	
 	
-	// begin outputting linked object file
-	aout = xfopen(TMP_FILE, "wb");
+	stat_mark(STAT_LAYOUT);
+	
+	// begin outputting linked object file, it is read back in to be mapped
+	otmp = (char *) xalloc(strlen(oname) + 16);
+	sprintf(otmp, "%s.%d", oname, getpid());
+	if (!(aout = fopen(otmp, "wb+")))
+		error("cannot open %s", oname);
+	stat_opens++;
 	
 	// emit the head
 	emhead();
 	
-	// open temp file
-	sprintf(tname, "/tmp/ltm%d", getpid());
-	ltmp = xfopen(tname, "wb");
-	
 	// emit the binary contents
 	embin();
 	
 	// write relocation header / data
 	wlend(tmp, ++reloc_rec);
 	fwrite(tmp, 2, 1, aout);
-	
-	// append contents of temp file to output
-	xfclose(ltmp);
-	ltmp = xfopen(tname, "rb");
-	while ((i = fread(tmp, 1, 512, ltmp)))
-		fwrite(tmp, 1, i, aout);
-	xfclose(ltmp);
-	remove(tname);
+	emrel();
+	stat_orelocs = reloc_rec - 1;
+	stat_mark(STAT_EMBIN);
 	
 	// write terminator
 	tmp[0] = tmp[1] = tmp[2] = 0;
@@ -1226,6 +2025,7 @@ int main(int argc, char *argv[])
 		// write actual symbol table
 		scopy();
 	}
+	stat_mark(STAT_SCOPY);
 	
 	// quickly copy over all externals
 	for (ext = ext_table; ext; ext = ext->next) {
@@ -1237,7 +2037,35 @@ int main(int argc, char *argv[])
 		}
 	}
 	
-	// close and move output file
-	xfclose(aout);
-	rename(TMP_FILE, "a.out");
+	// write out alignment
+	if (oalign[0] || oalign[1] || oalign[2]) {
+		tmp[0] = EXT_ALIGN;
+		wlend(tmp + 1, 3);
+		memcpy(tmp + 3, oalign, 3);
+		fwrite(tmp, 6, 1, aout);
+	}
+	
+	// write out line table
+	if (olines)
+		emlines();
+	
+	if (oalign[0] || oalign[1] || oalign[2] || olines)
+		fputc(EXT_END, aout);
+	
+	// close and move output file into place
+	stat_written += ftell(aout);
+	o = fclose(aout);
+	aout = NULL;
+	if (o || rename(otmp, oname)) {
+		remove(otmp);
+		error("cannot write %s", oname);
+	}
+	
+	// the map is only written for a link that worked
+	if (mname)
+		emmap();
+	
+	stat_mark(STAT_FINISH);
+	if (stats)
+		stat_print(stats > 1);
 } 
\ No newline at end of file
@@ -7,6 +7,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 /* defines */
 
@@ -15,15 +20,39 @@
 
 #define RELOC_REC_SIZE 3
 
-#define TMP_FILE "ldout.tmp"
+/* archive index member written by ranlib, and the sizes of its parts */
+#define ARCH_INDEX "__.TRASMDEF"
+#define ARCH_INDEX_HEAD 8
+#define ARCH_INDEX_MEM 8
+#define ARCH_INDEX_SYM (SYMBOL_REC_SIZE+2)
+
+/* buckets in the external and definition tables */
+#define EXT_HASH 1024
+
+/* header info flag, set if extension records follow the symbol table */
+#define H_EXT 0x04
+
+/* extension record types */
+#define EXT_END 0
+#define EXT_ALIGN 1
+#define EXT_LINES 2
+
+/* line table file index for bytes that have no source line */
+#define LINE_NONE 0xFF
 
 /* structs */
 
 // object header contains general information able how and where data will be linked
 struct object {
 	char *fname; // file name
-	uint8_t index;
-	size_t offset; // offset of record
+	int index; // member number if in an archive
+	
+	uint8_t *image; // whole object, mapped in once
+	size_t size;
+	uint8_t *rel; // relocation records
+	uint16_t nrel;
+	uint8_t *sym; // symbol records
+	uint16_t nsym;
 	
 	uint16_t org; // object address space origin
 	
@@ -35,16 +64,76 @@ struct object {
 	uint16_t data_base;
 	uint16_t bss_base;
 	
-	struct reference *head; // internal structs
-	struct reference *tail;
+	uint8_t align[3]; // segment alignments, as powers of 2
+	
+	uint8_t *lines; // line table record, or NULL
+	uint16_t nlines;
+	
+	uint8_t *orel[2]; // relocation records for the output, for each segment
+	uint16_t norel[2];
+	
+	struct xname *xname; // externals named by the symbol table, until they are added to the external table
+	uint16_t nxname;
+	uint16_t nglob; // globals in the symbol table
+	
+	struct extrn *ref[256]; // external each reference number stands for, or NULL
+	struct extrn *why; // external it was checked in to resolve, or NULL if it was an argument
 	
 	struct object *next; // next object
 	
 };
 
+// external named by a symbol record
+struct xname {
+	char name[SYMBOL_NAME_SIZE];
+	uint8_t number;
+	uint32_t hash; // of the name, kept whole so it can be compared before the name is
+};
+
+// object or archive member parsed during check in, possibly on a worker thread
+struct ldjob {
+	char *fname;
+	int member;
+	uint8_t *img;
+	size_t size;
+	struct object *obj; // object being checked in, or NULL if only its globals are needed
+	
+	char *err; // error found while parsing, or NULL
+	struct asym *defs; // globals it defines, in order
+};
+
+// global symbol defined by an object or archive member
+struct asym {
+	char name[SYMBOL_NAME_SIZE];
+	uint8_t type;
+	uint16_t value;
+	char *fname; // where it is defined
+	int member;
+	uint32_t hash;
+	
+	struct asym *next; // next symbol with the same hash, in argument order
+};
+
+// global symbol in the map file
+struct msym {
+	char name[SYMBOL_NAME_SIZE];
+	uint8_t type;
+	uint16_t value;
+	struct object *obj;
+	int order; // keeps symbols at the same address in layout order
+};
+
 // struct to hold known archives
 struct archive {
 	char *fname;
+	
+	uint8_t *map; // whole archive, mapped in for the link
+	size_t size;
+	
+	int nmem; // number of members
+	long *off; // where the data of each member starts
+	long *len; // size of each member
+	
 	struct archive *next;
 };
 
@@ -57,22 +146,11 @@ struct extrn {
 	struct object *source;
 	
 	uint8_t number; // reference number to undefined externals
+	uint32_t hash;
+	char seen; // named by an object that has been put in order
 	
 	struct extrn *next; // next external
-};
-
-// reference to extrn
-struct reference {
-	struct extrn *ext;
-	uint8_t number;
-	
-	struct reference *next;
-};
-
-// typed value
-struct tval {
-	uint8_t type;
-	uint16_t value;
+	struct extrn *hnext; // next external with the same hash
 };
 
 #endif
\ No newline at end of file
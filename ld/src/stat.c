@@ -0,0 +1,147 @@
+/*
+ * stat.c
+ *
+ * timing and counters for finding out where link time goes
+ */
+#include "stat.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/* counters */
+long stat_opens;
+long stat_seeks;
+long stat_read;
+long stat_written;
+long stat_resolved;
+long stat_members;
+long stat_indexed;
+long stat_externs;
+long stat_defs;
+long stat_lookups;
+long stat_probes;
+long stat_dlookups;
+long stat_dprobes;
+atomic_long stat_relocs;
+long stat_orelocs;
+
+/* time spent in each phase, in microseconds */
+long long stat_wall[STAT_PHASES];
+long long stat_cpu[STAT_PHASES];
+
+/* when the last phase ended */
+long long stat_lwall;
+long long stat_lcpu;
+
+/* phase names */
+char *stat_names[] = {"check_in", "resolve", "layout", "embin", "scopy", "finish"};
+
+/*
+ * reads a clock in microseconds
+ *
+ * id = clock to read
+ */
+long long stat_clock(clockid_t id)
+{
+	struct timespec ts;
+	
+	clock_gettime(id, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * clears all counters and starts timing the first phase
+ */
+void stat_reset()
+{
+	int i;
+	
+	stat_opens = stat_seeks = stat_read = stat_written = 0;
+	stat_resolved = stat_members = stat_indexed = 0;
+	stat_externs = stat_defs = 0;
+	stat_lookups = stat_probes = stat_dlookups = stat_dprobes = 0;
+	atomic_store(&stat_relocs, 0);
+	stat_orelocs = 0;
+	
+	for (i = 0; i < STAT_PHASES; i++)
+		stat_wall[i] = stat_cpu[i] = 0;
+	
+	stat_lwall = stat_clock(CLOCK_MONOTONIC);
+	stat_lcpu = stat_clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/*
+ * marks the end of a phase, time since the last mark is charged to it
+ *
+ * phase = phase that just ended
+ */
+void stat_mark(int phase)
+{
+	long long wall, cpu;
+	
+	wall = stat_clock(CLOCK_MONOTONIC);
+	cpu = stat_clock(CLOCK_PROCESS_CPUTIME_ID);
+	
+	stat_wall[phase] += wall - stat_lwall;
+	stat_cpu[phase] += cpu - stat_lcpu;
+	
+	stat_lwall = wall;
+	stat_lcpu = cpu;
+}
+
+/*
+ * returns the average of a count over a number of events
+ *
+ * sum = total count
+ * n = number of events
+ */
+double stat_avg(long sum, long n)
+{
+	return n ? (double) sum / n : 0;
+}
+
+/*
+ * prints out everything collected during the link
+ *
+ * json = print as a json object instead of a table
+ */
+void stat_print(char json)
+{
+	struct rusage ru;
+	int i;
+	
+	getrusage(RUSAGE_SELF, &ru);
+	
+	if (json) {
+		printf("{\"phases\": {");
+		for (i = 0; i < STAT_PHASES; i++)
+			printf("%s\"%s\": {\"wall_us\": %lld, \"cpu_us\": %lld}", i ? ", " : "", stat_names[i], stat_wall[i], stat_cpu[i]);
+		printf("}, \"externals_resolved\": %ld, \"members_checked_in\": %ld, \"archives_indexed\": %ld", stat_resolved, stat_members, stat_indexed);
+		printf(", \"files_opened\": %ld, \"seeks\": %ld, \"bytes_read\": %ld, \"bytes_written\": %ld", stat_opens, stat_seeks, stat_read, stat_written);
+		printf(", \"externals\": %ld, \"external_lookups\": %ld, \"external_chain_avg\": %.2f", stat_externs, stat_lookups, stat_avg(stat_probes, stat_lookups));
+		printf(", \"definitions\": %ld, \"definition_lookups\": %ld, \"definition_chain_avg\": %.2f", stat_defs, stat_dlookups, stat_avg(stat_dprobes, stat_dlookups));
+		printf(", \"relocations\": %ld, \"output_relocations\": %ld", atomic_load(&stat_relocs), stat_orelocs);
+		printf(", \"max_rss_kb\": %ld}\n", ru.ru_maxrss);
+		return;
+	}
+	
+	printf("%-16s %12s %12s\n", "phase", "wall ms", "cpu ms");
+	for (i = 0; i < STAT_PHASES; i++)
+		printf("%-16s %12.3f %12.3f\n", stat_names[i], stat_wall[i] / 1000.0, stat_cpu[i] / 1000.0);
+	
+	printf("%-16s %12ld\n", "resolved", stat_resolved);
+	printf("%-16s %12ld\n", "members in", stat_members);
+	printf("%-16s %12ld\n", "indexed", stat_indexed);
+	printf("%-16s %12ld\n", "files opened", stat_opens);
+	printf("%-16s %12ld\n", "seeks", stat_seeks);
+	printf("%-16s %12ld\n", "bytes read", stat_read);
+	printf("%-16s %12ld\n", "bytes written", stat_written);
+	printf("%-16s %12ld\n", "externals", stat_externs);
+	printf("%-16s %12ld  avg chain %.2f\n", "ext lookups", stat_lookups, stat_avg(stat_probes, stat_lookups));
+	printf("%-16s %12ld\n", "definitions", stat_defs);
+	printf("%-16s %12ld  avg chain %.2f\n", "def lookups", stat_dlookups, stat_avg(stat_dprobes, stat_dlookups));
+	printf("%-16s %12ld\n", "relocations", atomic_load(&stat_relocs));
+	printf("%-16s %12ld\n", "out relocations", stat_orelocs);
+	printf("%-16s %12ld\n", "max rss kb", ru.ru_maxrss);
+}
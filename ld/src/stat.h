@@ -0,0 +1,39 @@
+#ifndef STAT_H
+#define STAT_H
+
+/* includes */
+#include <stdatomic.h>
+
+/* phases of linking, in order */
+#define STAT_CHECKIN 0
+#define STAT_RESOLVE 1
+#define STAT_LAYOUT 2
+#define STAT_EMBIN 3
+#define STAT_SCOPY 4
+#define STAT_FINISH 5
+#define STAT_PHASES 6
+
+/* counters, bumped by the rest of the link editor */
+extern long stat_opens;
+extern long stat_seeks;
+extern long stat_read;
+extern long stat_written;
+extern long stat_resolved;
+extern long stat_members;
+extern long stat_indexed;
+extern long stat_externs;
+extern long stat_defs;
+extern long stat_lookups;
+extern long stat_probes;
+extern long stat_dlookups;
+extern long stat_dprobes;
+extern atomic_long stat_relocs;
+extern long stat_orelocs;
+
+/* interface functions */
+
+void stat_reset();
+void stat_mark(int phase);
+void stat_print(char json);
+
+#endif
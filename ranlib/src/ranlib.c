@@ -0,0 +1,310 @@
+/*
+ * ranlib.c
+ *
+ * archive index tool for TRASM toolchain
+ */
+
+#include "ranlib.h"
+
+#define VERSION "1.0"
+
+/* arg zero */
+char *argz;
+
+/* buffers */
+uint8_t tmp[512];
+
+/* whole archive, read in once */
+uint8_t *arch;
+long arch_size;
+
+/* object members */
+struct member *mem_table;
+int mem_count;
+int mem_size;
+
+
+/*
+ * prints error message, and exits
+ *
+ * msg = error message
+ */
+void error(char *msg, char *issue)
+{
+	printf("error: ");
+	printf(msg, issue);
+	printf("\n");
+
+	exit(1);
+}
+
+/*
+ * print usage message
+ */
+void usage()
+{
+	printf("usage: %s archive.a\n", argz);
+	exit(1);
+}
+
+/*
+ * close file and check for success
+ *
+ * f = pointer to file
+ */
+void xfclose(FILE *f)
+{
+	if (fclose(f))
+		error("cannot close", NULL);
+}
+
+/*
+ * open file and check for success
+ *
+ * fname = path to file
+ * mode = mode to open
+ * returns pointer to file
+ */
+FILE *xfopen(char *fname, char *mode)
+{
+	FILE *f;
+
+	if (!(f = fopen(fname, mode))) {
+		error("cannot open %s", fname);
+	}
+	return f;
+}
+
+/*
+ * read little endian, read 2 bytes in little endian format
+ *
+ * b = pointer to first byte
+ * return value of word
+ */
+uint16_t rlend(uint8_t *b)
+{
+	return b[0] + (b[1] << 8);
+}
+
+/*
+ * write little endian, write 2 bytes of little endian format
+ *
+ * value = value to write
+ * b = byte array
+ */
+void wlend(uint8_t *b, uint16_t value)
+{
+	*b = value & 0xFF;
+	*(++b) = value >> 8;
+}
+
+/*
+ * write little endian, write 4 bytes of little endian format
+ *
+ * value = value to write
+ * b = byte array
+ */
+void wlend32(uint8_t *b, uint32_t value)
+{
+	wlend(b, value & 0xFFFF);
+	wlend(b + 2, value >> 16);
+}
+
+/*
+ * reads the whole archive in
+ *
+ * fname = archive
+ */
+void rdarch(char *fname)
+{
+	FILE *f;
+
+	f = xfopen(fname, "rb");
+	fseek(f, 0, SEEK_END);
+	arch_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	if (!(arch = (uint8_t *) malloc(arch_size + 1)))
+		error("out of memory", NULL);
+	if (arch_size < 8 || fread(arch, arch_size, 1, f) != 1 || memcmp(arch, ARCH_MAGIC, 8))
+		error("%s not an archive", fname);
+
+	xfclose(f);
+}
+
+/*
+ * finds the symbol table of an object member
+ *
+ * m = member, with its header and size filled in
+ * returns true (1) if it is an object, or false (0)
+ */
+char rdsym(struct member *m)
+{
+	uint8_t *img;
+	long off;
+
+	img = arch + m->head + ARCH_HEAD;
+	if (m->size < 16 || img[0x00] != 0x18 || img[0x01] != 0x0E)
+		return 0;
+
+	// relocations come right after the binary, then symbols
+	off = rlend(&img[0x0C]);
+	if (off < 16 || off + 2 > m->size)
+		return 0;
+
+	off += 2 + rlend(img + off) * RELOC_REC_SIZE;
+	if (off + 2 > m->size)
+		return 0;
+	m->nsym = rlend(img + off);
+	m->sym = img + off + 2;
+
+	return off + 2 + m->nsym * SYMBOL_REC_SIZE <= m->size;
+}
+
+/*
+ * walks the archive, finding every object member
+ * an index that is already there is left out
+ *
+ * fname = archive
+ */
+void rdmem(char *fname)
+{
+	struct member *m;
+	long start, size;
+
+	for (start = 8; start + ARCH_HEAD <= arch_size; start += ARCH_HEAD + size + (size % 2)) {
+		memcpy(tmp, arch + start, ARCH_HEAD);
+		tmp[58] = 0;
+		size = atol((char *) tmp + 48);
+
+		if (size < 0 || start + ARCH_HEAD + size > arch_size)
+			error("%s is damaged", fname);
+
+		if (!memcmp(tmp, ARCH_INDEX, strlen(ARCH_INDEX)))
+			continue;
+
+		if (mem_count == mem_size) {
+			mem_size = mem_size ? mem_size * 2 : 64;
+			if (!(mem_table = (struct member *) realloc(mem_table, sizeof(struct member) * mem_size)))
+				error("out of memory", NULL);
+		}
+
+		m = &mem_table[mem_count++];
+		m->head = start;
+		m->size = size;
+		if (!rdsym(m))
+			error("%s has a member that is not an object", fname);
+	}
+
+	if (mem_count > 0xFFFF)
+		error("%s has too many members", fname);
+}
+
+/*
+ * writes the archive back out, with the index as its first member
+ *
+ * fname = archive
+ */
+void wrarch(char *fname)
+{
+	FILE *f;
+	uint8_t *idx, *rec, *sym;
+	long isize, size, off;
+	int nsym, i, j;
+	char *tname;
+
+	// count the globals
+	nsym = 0;
+	for (i = 0; i < mem_count; i++) {
+		for (j = 0, sym = mem_table[i].sym; j < mem_table[i].nsym; j++, sym += SYMBOL_REC_SIZE)
+			if (sym[SYMBOL_NAME_SIZE-1] < 5)
+				nsym++;
+	}
+	if (nsym > 0xFFFF)
+		error("%s has too many symbols", fname);
+
+	isize = ARCH_INDEX_HEAD + mem_count * ARCH_INDEX_MEM + nsym * ARCH_INDEX_SYM;
+	if (!(idx = (uint8_t *) calloc(1, isize)))
+		error("out of memory", NULL);
+
+	// the size of the new archive, so a changed archive can be told apart
+	size = 8 + ARCH_HEAD + isize + (isize % 2);
+	for (i = 0; i < mem_count; i++)
+		size += ARCH_HEAD + mem_table[i].size + (mem_table[i].size % 2);
+	wlend32(idx, size);
+	wlend(idx + 4, mem_count);
+	wlend(idx + 6, nsym);
+
+	// where each member's data ends up
+	rec = idx + ARCH_INDEX_HEAD;
+	off = 8 + ARCH_HEAD + isize + (isize % 2);
+	for (i = 0; i < mem_count; i++, rec += ARCH_INDEX_MEM) {
+		wlend32(rec, off + ARCH_HEAD);
+		wlend32(rec + 4, mem_table[i].size);
+		off += ARCH_HEAD + mem_table[i].size + (mem_table[i].size % 2);
+	}
+
+	// and the globals each one defines, in member order
+	for (i = 0; i < mem_count; i++) {
+		for (j = 0, sym = mem_table[i].sym; j < mem_table[i].nsym; j++, sym += SYMBOL_REC_SIZE) {
+			if (sym[SYMBOL_NAME_SIZE-1] > 4)
+				continue;
+
+			memcpy(rec, sym, SYMBOL_REC_SIZE);
+			wlend(rec + SYMBOL_REC_SIZE, i);
+			rec += ARCH_INDEX_SYM;
+		}
+	}
+
+	// written next to the archive, then moved into place
+	if (!(tname = (char *) malloc(strlen(fname) + 8)))
+		error("out of memory", NULL);
+	sprintf(tname, "%s.tmp", fname);
+	f = xfopen(tname, "wb");
+
+	fwrite(ARCH_MAGIC, 8, 1, f);
+	sprintf((char *) tmp, "%-16s%-12s%-6s%-6s%-8s%-10ld`\n", ARCH_INDEX, "0", "0", "0", "644", isize);
+	fwrite(tmp, ARCH_HEAD, 1, f);
+	fwrite(idx, isize, 1, f);
+	if (isize % 2)
+		fputc('\n', f);
+
+	for (i = 0; i < mem_count; i++) {
+		fwrite(arch + mem_table[i].head, ARCH_HEAD + mem_table[i].size, 1, f);
+		if (mem_table[i].size % 2)
+			fputc('\n', f);
+	}
+
+	if (ftell(f) != size)
+		error("cannot write %s", tname);
+	xfclose(f);
+
+	if (rename(tname, fname)) {
+		remove(tname);
+		error("cannot write %s", fname);
+	}
+
+	free(tname);
+	free(idx);
+}
+
+
+int main(int argc, char *argv[])
+{
+	// record arg zero
+	argz = argv[0];
+
+	// make sure args make sense
+	if (argc != 2)
+		usage();
+
+	// read in the members
+	rdarch(argv[1]);
+	rdmem(argv[1]);
+
+	// write it back out indexed
+	wrarch(argv[1]);
+
+	free(mem_table);
+	free(arch);
+}
@@ -0,0 +1,36 @@
+#ifndef RANLIB_H
+#define RANLIB_H
+
+/* includes */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* defines */
+#define SYMBOL_NAME_SIZE 9
+#define SYMBOL_REC_SIZE ((SYMBOL_NAME_SIZE-1)+3)
+
+#define RELOC_REC_SIZE 3
+
+/* archive member headers */
+#define ARCH_MAGIC "!<arch>\n"
+#define ARCH_HEAD 60
+
+/* index member, and the sizes of its parts */
+#define ARCH_INDEX "__.TRASMDEF"
+#define ARCH_INDEX_HEAD 8
+#define ARCH_INDEX_MEM 8
+#define ARCH_INDEX_SYM (SYMBOL_REC_SIZE+2)
+
+/* structs */
+
+// object member of the archive
+struct member {
+	long head; // where its header starts in the old archive
+	long size; // size of its data
+	uint8_t *sym; // symbol records
+	uint16_t nsym;
+};
+
+#endif
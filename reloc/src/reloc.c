@@ -25,6 +25,9 @@ char flagd = 0;
 uint16_t tbase; // text base
 uint16_t bbase; // optional bss base
 
+/* segment alignments, as powers of 2 */
+uint8_t align[3];
+
 /* stream stuff */
 FILE *relf;
 uint16_t nreloc;
@@ -233,6 +236,118 @@ void skipsg(FILE *f, uint8_t size)
 	xfseek(f, rlend(b) * size, SEEK_CUR);
 }
 
+/*
+ * reads the alignment out of the extension records, if there are any
+ *
+ * fname = object file
+ */
+void rdext(char *fname)
+{
+	FILE *f;
+	uint8_t b[3];
+	uint16_t size;
+	
+	align[0] = align[1] = align[2] = 0;
+	
+	f = xfopen(fname, "rb");
+	fread(header, 16, 1, f);
+	
+	if (header[0x02] & H_EXT) {
+		// extensions are after everything else
+		xfseek(f, rlend(&header[0x0C]) - 16, SEEK_CUR);
+		skipsg(f, RELOC_REC_SIZE);
+		skipsg(f, SYMBOL_REC_SIZE);
+		
+		while (fread(b, 1, 1, f) == 1 && b[0] != EXT_END) {
+			fread(b + 1, 2, 1, f);
+			size = rlend(b + 1);
+			
+			if (b[0] == EXT_ALIGN && size >= 3) {
+				fread(align, 3, 1, f);
+				size -= 3;
+			}
+			
+			xfseek(f, size, SEEK_CUR);
+		}
+	}
+	
+	xfclose(f);
+}
+
+/*
+ * makes sure a segment will still be aligned once it is moved
+ *
+ * base = where the start of the segment will end up
+ * seg = segment (0 = text, 1 = data, 2 = bss)
+ */
+void chkalign(uint16_t base, int seg)
+{
+	char *names[] = { "text", "data", "bss" };
+	
+	if (base & ((1 << align[seg]) - 1))
+		error("base breaks %s alignment", names[seg]);
+}
+
+/*
+ * copies the line table over, moving it along with the text
+ * rows are address deltas, so only the first one needs to change
+ * nothing is copied if symbols are being removed
+ *
+ * bin = object file, at the start of the record data
+ * size = size of the record data
+ */
+void mvlines(FILE *bin, uint16_t size)
+{
+	uint8_t *lt, vlq[3];
+	uint16_t addr;
+	int i, j, n, nfile, shift;
+	
+	lt = (uint8_t *) xalloc(size);
+	fread(lt, size, 1, bin);
+	
+	if (flags) {
+		free(lt);
+		return;
+	}
+	
+	// skip the file names
+	nfile = lt[0];
+	for (i = 1; nfile--; i++)
+		while (lt[i]) i++;
+	
+	// read the first address
+	addr = 0;
+	shift = 0;
+	for (j = i; j < size; j++) {
+		addr |= (lt[j] & 0x7F) << shift;
+		shift += 7;
+		if (!(lt[j] & 0x80)) {
+			j++;
+			break;
+		}
+	}
+	
+	// write it back moved
+	n = 0;
+	if (j > i) {
+		addr += tbase;
+		while (addr > 0x7F) {
+			vlq[n++] = (addr & 0x7F) | 0x80;
+			addr >>= 7;
+		}
+		vlq[n++] = addr;
+	}
+	
+	tmp[0] = EXT_LINES;
+	wlend(tmp + 1, size - (j - i) + n);
+	fwrite(tmp, 3, 1, aout);
+	fwrite(lt, i, 1, aout);
+	fwrite(vlq, n, 1, aout);
+	fwrite(lt + j, size - j, 1, aout);
+	
+	free(lt);
+}
+
 /*
  * closes up the currectly open stream
  */
@@ -287,9 +402,12 @@ void snext(struct tval *out)
 void reloc(char *fname)
 {
 	FILE *bin;
-	uint16_t value, bsize, last, chunk;
+	uint16_t value, bsize, last, chunk, org;
 	struct tval next;
 	
+	// find out how segments need to be aligned
+	rdext(fname);
+	
 	// open and read header
 	bin = xfopen(fname, "rb");
 	fread(header, 16, 1, bin);
@@ -303,6 +421,7 @@ void reloc(char *fname)
 	
 	// save tbase
 	last = tbase;
+	org = rlend(&header[0x03]);
 	
 	// account for text base
 	tbase -= rlend(&header[0x03]);
@@ -332,6 +451,14 @@ void reloc(char *fname)
 		bbase -= 16;
 	}
 	
+	// text and data are aligned from where the header is, bss from the top of data
+	chkalign(org + tbase, 0);
+	chkalign(org + tbase, 1);
+	if (flagb)
+		chkalign(org + rlend(&header[0x0C]) + bbase, 2);
+	else
+		chkalign(org + tbase, 2);
+	
 	// open stream and start relocation
 	sopen(fname);
 
@@ -429,15 +556,13 @@ void reloc(char *fname)
 	fread(tmp, 2, 1, bin);
 	
 	// if flag s, just don't write a symbol table
+	bsize = rlend(tmp);
 	if (flags) {
+		xfseek(bin, bsize * SYMBOL_REC_SIZE, SEEK_CUR);
+		bsize = 0;
 		tmp[0] = tmp[1] = 0;
-		fwrite(tmp, 2, 1, aout);
-		return;
-	} else  {
-		fwrite(tmp, 2, 1, aout);
 	}
-	
-	bsize = rlend(tmp);
+	fwrite(tmp, 2, 1, aout);
 	
 	while (bsize--) {
 
@@ -469,6 +594,29 @@ void reloc(char *fname)
 		// write back symbol
 		fwrite(tmp, SYMBOL_REC_SIZE, 1, aout);
 	}
+	
+	// extension records do not change, except for the line table
+	if (header[0x02] & H_EXT) {
+		while (fread(tmp, 1, 1, bin) == 1 && tmp[0] != EXT_END) {
+			fread(tmp + 1, 2, 1, bin);
+			bsize = rlend(tmp + 1);
+			
+			if (tmp[0] == EXT_LINES) {
+				mvlines(bin, bsize);
+				continue;
+			}
+			
+			fwrite(tmp, 3, 1, aout);
+			while (bsize) {
+				chunk = bsize > 512 ? 512 : bsize;
+				fread(tmp, chunk, 1, bin);
+				fwrite(tmp, chunk, 1, aout);
+				bsize -= chunk;
+			}
+		}
+		
+		fputc(EXT_END, aout);
+	}
 }
 
 
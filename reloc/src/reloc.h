@@ -15,6 +15,14 @@
 
 #define TMP_FILE "rlout.tmp"
 
+/* header info flag, set if extension records follow the symbol table */
+#define H_EXT 0x04
+
+/* extension record types */
+#define EXT_END 0
+#define EXT_ALIGN 1
+#define EXT_LINES 2
+
 /* structs */
 
 // typed value
@@ -136,9 +136,34 @@ void strip(char *src)
 	}
 	
 	// write out # of symbols
+	fread(tmp, 2, 1, f);
+	fseek(f, rlend(tmp) * SYMBOL_REC_SIZE, SEEK_CUR);
 	tmp[0] = tmp[1] = 0;
 	fwrite(tmp, 2, 1, aout);
 	
+	// extension records are kept, except for the line table
+	if (header[0x02] & H_EXT) {
+		while (fread(tmp, 1, 1, f) == 1 && tmp[0] != EXT_END) {
+			fread(tmp + 1, 2, 1, f);
+			bsize = rlend(tmp + 1);
+			
+			if (tmp[0] == EXT_LINES) {
+				fseek(f, bsize, SEEK_CUR);
+				continue;
+			}
+			
+			fwrite(tmp, 3, 1, aout);
+			while (bsize) {
+				chunk = bsize > 512 ? 512 : bsize;
+				fread(tmp, chunk, 1, f);
+				fwrite(tmp, chunk, 1, aout);
+				bsize -= chunk;
+			}
+		}
+		
+		fputc(EXT_END, aout);
+	}
+	
 	// close file
 	xfclose(f);
 }
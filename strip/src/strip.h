@@ -7,8 +7,18 @@
 #include <stdlib.h>
 
 /* defines */
+#define SYMBOL_NAME_SIZE 9
+#define SYMBOL_REC_SIZE ((SYMBOL_NAME_SIZE-1)+3)
+
 #define RELOC_REC_SIZE 3
 
 #define TMP_FILE "stout.tmp"
 
+/* header info flag, set if extension records follow the symbol table */
+#define H_EXT 0x04
+
+/* extension record types */
+#define EXT_END 0
+#define EXT_LINES 2
+
 #endif
\ No newline at end of file
@@ -7,3 +7,55 @@ mkdir -p lib
 ../as_r src/hello.s ; mv a.out obj/hello.o
 rm lib/liba.a
 ar r lib/liba.a obj/getc.o obj/putc.o obj/puts.o
+../as_r --emit-pch -o obj/hdr.pch src/hdr.s || echo "FAIL: hdr"
+../as_r --pch obj/hdr.pch src/usehdr.s || echo "FAIL: usehdr" ; mv a.out obj/usehdr.o
+../as_r src/puts.s src/putc.s ; mv a.out obj/cat.o
+../as_r -p src/puts.s src/putc.s || echo "FAIL: pipelined" ; mv a.out obj/catp.o
+cmp -s obj/cat.o obj/catp.o || echo "FAIL: pipelined differs"
+../as_r --stats=json src/hello.s | grep -q '"tokens": ' || echo "FAIL: stats" ; mv a.out obj/stats.o
+../as_r -j src/puts.s src/putc.s || echo "FAIL: split" ; mv a.out obj/catj.o
+cmp -s obj/cat.o obj/catj.o || echo "FAIL: split differs"
+../as_r -O -v src/peep.s > obj/peep.log || echo "FAIL: peep" ; mv a.out obj/peep.o
+[ "$(grep -cE "  1( |$)" obj/peep.log)" = 5 ] || echo "FAIL: peep rules"
+../as_r src/align.s || echo "FAIL: align" ; mv a.out obj/align.o
+../nm_r obj/align.o | grep -q "^0030 d table" || echo "FAIL: align table"
+../as_r src/rept.s || echo "FAIL: rept" ; mv a.out obj/rept.o
+../nm_r obj/rept.o | grep -q "^0030 d table" || echo "FAIL: rept align"
+../as_r --stack src/stack.s | grep -q "^main  *8" || echo "FAIL: stack" ; mv a.out obj/stack.o
+../as_r --page-cache 256 src/rept.s || echo "FAIL: page cache" ; mv a.out obj/reptp.o
+cmp -s obj/rept.o obj/reptp.o || echo "FAIL: page cache differs"
+../as_r -L src/hello.s || echo "FAIL: lines" ; mv a.out obj/hellol.o
+cmp -s obj/hello.o obj/hellol.o && echo "FAIL: no line table"
+../as_r src/cycles.s || echo "FAIL: cycles" ; mv a.out obj/cycles.o
+../as_r -l obj/relax.lst src/relax.s || echo "FAIL: relax" ; mv a.out obj/relax.o
+grep -q "^t 0010  18 7F " obj/relax.lst || echo "FAIL: relax 127 ahead"
+grep -q "^t 0091  C3 14 01 " obj/relax.lst || echo "FAIL: relax 128 ahead"
+grep -q "^t 0192  18 80 " obj/relax.lst || echo "FAIL: relax 128 back"
+grep -q "^t 0213  C3 94 01 " obj/relax.lst || echo "FAIL: relax 129 back"
+grep -q "^t 0216  C3 99 02 " obj/relax.lst || echo "FAIL: relax rerun"
+../as_r -l obj/list.lst src/list.s || echo "FAIL: list" ; mv a.out obj/list.o
+grep -q "^d 004C  01 02 03 04" obj/list.lst || echo "FAIL: list rows"
+../as_r -l obj/bad.lst src/bad.s >/dev/null && echo "FAIL: bad" ; [ -e obj/bad.lst ] && echo "FAIL: bad listing"
+../as_r --z80-budget 100 -o obj/budget.o src/relax.s >/dev/null && echo "FAIL: budget"
+../as_r src/cyclesbad.s > obj/cyclesbad.log && echo "FAIL: cyclesbad"
+grep -q "block repeat at 0010 needs a .loop bound" obj/cyclesbad.log || echo "FAIL: cycles unbounded repeat"
+grep -q "worst case is 5371 T-states" obj/cyclesbad.log || echo "FAIL: cycles repeat cost"
+../as_r --page-cache 256 src/pages.s | grep -q "page cache too small" || echo "FAIL: page cache cap"
+../as_r --page-cache 512 src/pages.s || echo "FAIL: page cache" ; mv a.out obj/pagesp.o
+../as_r src/pages.s || echo "FAIL: pages" ; mv a.out obj/pages.o
+cmp -s obj/pages.o obj/pagesp.o || echo "FAIL: page cache differs"
+../as_r src/unterm.s src/hello.s | grep -q "unterm.s:3: unterminated string" || echo "FAIL: unterminated string"
+../as_r -j src/unterm.s src/hello.s | grep -q "unterm.s:3: unterminated string" || echo "FAIL: split unterminated string"
+../as_r --stack=json -o obj/stacka.o src/stacka.s > obj/stacka.json || echo "FAIL: stacka"
+../as_r --stack=json -o obj/stackb.o src/stackb.s > obj/stackb.json || echo "FAIL: stackb"
+../as_r --stack-sum obj/stacka.json obj/stackb.json > obj/stacksum.log || echo "FAIL: stack sum"
+grep -q "^main  *18  rst_38+8$" obj/stacksum.log || echo "FAIL: stack sum depth"
+grep -q "^ping  *4  recursive$" obj/stacksum.log || echo "FAIL: stack sum recursion"
+for f in ordmain ordc ordb orda; do ../as_r src/$f.s || echo "FAIL: $f" ; mv a.out obj/$f.o; done
+rm -f lib/libord.a
+ar r lib/libord.a obj/ordc.o obj/ordb.o obj/orda.o
+cp lib/libord.a lib/libordi.a
+../ranlib_r lib/libordi.a || echo "FAIL: ranlib"
+{ echo ".text"; for i in $(seq 1 1100); do echo "l$i:"; echo "	nop"; done; } > obj/labels.s
+../as_r -l obj/labels.lst -o obj/labels.o obj/labels.s || echo "FAIL: list labels"
+grep -q "^l1100  *4$" obj/labels.lst || echo "FAIL: list label totals"
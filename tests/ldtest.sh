@@ -6,3 +6,15 @@ z80dasm -l -g 0x0000 -o out/a.asm out/a.out
 cp out/a.out out/arel.out
 ../reloc_r -n out/arel.out 0x1000
 z80dasm -l -g 0x1000 -o out/arel.asm out/arel.out
+../ld_r obj/hellol.o lib/liba.a || echo "FAIL: ld lines" ; mv a.out out/l.out
+../ld_r -j obj/hello.o lib/liba.a || echo "FAIL: ld -j" ; mv a.out out/j.out
+cmp -s out/a.out out/j.out || echo "FAIL: ld -j differs"
+../ld_r -o out/b.out obj/hello.o lib/liba.a || echo "FAIL: ld -o"
+cmp -s out/a.out out/b.out || echo "FAIL: ld -o differs"
+../ld_r -M out/b.map -o out/m.out obj/hello.o lib/liba.a || echo "FAIL: ld -M"
+grep -q "^0029  data  hello_s  obj/hello.o" out/b.map || echo "FAIL: ld map"
+../ld_r --stats=json -o out/s.out obj/hello.o lib/liba.a | grep -q '"members_checked_in": 2' || echo "FAIL: ld stats"
+../ld_r -o out/ord.out obj/ordmain.o lib/libord.a || echo "FAIL: ld order"
+../nm_r out/ord.out | grep -q "^0017 t orderb" || echo "FAIL: ld member order"
+../ld_r --stats=json -o out/ordi.out obj/ordmain.o lib/libordi.a | grep -q '"archives_indexed": 1' || echo "FAIL: ld index"
+cmp -s out/ord.out out/ordi.out || echo "FAIL: ld index differs"
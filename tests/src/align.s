@@ -0,0 +1,11 @@
+; a table aligned past the code in front of it
+.text
+start:
+	ld hl,table
+	ret
+.data
+	.def byte 1, 2, 3
+.align 16
+.globl table
+table:
+	.def byte 4
@@ -0,0 +1,3 @@
+; fails to assemble, no listing should be left behind
+.text
+	ld a,
@@ -0,0 +1,33 @@
+; cycle budgets, including a long bounded loop and a budget past 16 bits
+.text
+	.assert_cycles fill, fill_end, 27000
+fill:
+	ld c,4
+2:	ld b,0
+1:	ld (hl),a
+	inc hl
+	.loop 255
+	djnz 1b
+	dec c
+	.loop 3
+	jr nz,2b
+fill_end:
+	ret
+
+	.assert_cycles wait, wait_end, 300000
+wait:
+1:	dec bc
+	ld a,b
+	or c
+	.loop 10000
+	jr nz,1b
+wait_end:
+	ret
+
+	.assert_cycles copy, copy_end, 5400
+copy:
+	ld bc,256
+	.loop 256
+	ldir
+copy_end:
+	ret
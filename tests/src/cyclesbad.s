@@ -0,0 +1,14 @@
+; cycle budgets that must fail, a block repeat with no bound and one that runs over
+.text
+	.assert_cycles copy, copy_end, 5400
+copy:
+	ldir
+copy_end:
+	ret
+
+	.assert_cycles fill, fill_end, 5000
+fill:
+	.loop 256
+	ldir
+fill_end:
+	ret
@@ -0,0 +1,16 @@
+; constants and types shared by several sources, built into a precompiled header
+BDOS = 5
+CONOUT = 2
+CONIN = 1
+
+.type point {
+  byte x,
+  byte y
+}
+
+.type sprite {
+  point pos,
+  byte[4] frames,
+  word image,
+  byte flags
+}
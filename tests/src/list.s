@@ -0,0 +1,11 @@
+; a block too long for one row of the listing, every byte should be shown
+.text
+start:
+	ld hl,table
+	ret
+.data
+table:
+.rept 20
+	.def byte 1, 2, 3, 4
+.endr
+	.def byte 5
@@ -0,0 +1,7 @@
+; third member, brings in the first
+.extern orderc
+.text
+.globl ordera
+ordera:
+	call orderc
+	ret
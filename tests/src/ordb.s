@@ -0,0 +1,6 @@
+; second member
+.text
+.globl orderb
+orderb:
+	ld a,2
+	ret
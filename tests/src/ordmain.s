@@ -0,0 +1,6 @@
+; calls into an archive whose members are out of order, they are linked in sweeps over the archive
+.extern ordera, orderb
+.text
+	call ordera
+	call orderb
+	ret
@@ -0,0 +1,24 @@
+; symbols from two pages on one line, the page cache needs room for both
+.text
+s0 = 0
+s1 = 1
+s2 = 2
+s3 = 3
+s4 = 4
+s5 = 5
+s6 = 6
+s7 = 7
+s8 = 8
+s9 = 9
+s10 = 10
+s11 = 11
+s12 = 12
+s13 = 13
+s14 = 14
+s15 = 15
+s16 = 16
+s17 = 17
+s18 = 18
+s19 = 19
+	ld hl,s0+s19
+	ret
@@ -0,0 +1,13 @@
+; every peephole rule has something to rewrite, assembled with -O
+ZERO = 0
+.text
+start:
+	ld a,0
+	cp ZERO
+	call work
+	ret
+work:
+	sla l
+	rl h
+	jp 1f
+1:	ret
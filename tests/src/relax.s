@@ -0,0 +1,38 @@
+; jumps just within and just past the reach of a relative jump
+.text
+start:
+	; 127 bytes ahead stays short, 128 is made long
+	jmp 1f
+.rept 127
+	nop
+.endr
+1:	jmp 1f
+.rept 128
+	nop
+.endr
+
+	; 128 bytes back stays short, 129 is made long
+1:
+.rept 126
+	nop
+.endr
+	jmp 1b
+1:
+.rept 127
+	nop
+.endr
+	jmp 1b
+
+	; made long on a rerun, once the jump inside it was
+	jmp 2f
+	jmp 3f
+.rept 125
+	nop
+.endr
+2:
+.rept 3
+	nop
+.endr
+3:	jr near
+near:	djnz 3b
+	ret
@@ -0,0 +1,19 @@
+; repeated blocks, with a counter and nested, then a table aligned after them
+.text
+start:
+	ld hl,table
+	ret
+.data
+.rept 4, i
+	.def byte i * i
+.endr
+.rept 2
+.rept 3
+	.def byte 0xAA
+.endr
+	.def byte 0x55
+.endr
+.align 16
+.globl table
+table:
+	.def byte 1
@@ -0,0 +1,14 @@
+; stack depth of global routines, one calling another
+.text
+.globl main, work
+main:
+	push hl
+	push de
+	call work
+	pop de
+	pop hl
+	ret
+work:
+	push bc
+	pop bc
+	ret
@@ -0,0 +1,22 @@
+; stack depth across objects, stackb.s calls back into here
+.extern count, tick, ping
+.text
+.globl main, again, pong
+main:
+	push hl
+	call count
+	pop hl
+	push af
+	push bc
+	call tick
+	pop bc
+	pop af
+	ret
+again:
+	push de
+	call count
+	pop de
+	ret
+pong:
+	call ping
+	ret
@@ -0,0 +1,21 @@
+; stack depth across objects, with a loop back through stacka.s
+.extern again, pong
+.text
+.globl count, tick, ping
+count:
+	push bc
+	push de
+	pop de
+	pop bc
+	ret
+tick:
+	push hl
+	call again
+	pop hl
+	rst 0x38
+	ret
+ping:
+	push hl
+	call pong
+	pop hl
+	ret
@@ -0,0 +1,3 @@
+; a string left open at the end of the source, it must not run on into the next one
+.text
+	.def byte "open
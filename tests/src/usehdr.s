@@ -0,0 +1,14 @@
+; assembled against the precompiled header built from hdr.s
+.text
+start:
+	ld ix,player
+	ld a,(ix+sprite.flags)
+	ld c,CONOUT
+	ld e,a
+	call BDOS
+	ld hl,(player+sprite.image)
+	ld a,sprite
+	ret
+.data
+player:
+	.def byte 1, 2, 0, 1, 2, 3, 0x34, 0x12, 0x80